@@ -0,0 +1,99 @@
+/*
+apu.c
+Measure the cost of the audio sample generation
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bench.h"
+#include "gb_system.h"
+#include "apu/apu.h"
+#include "apu/sound_regs.h"
+#include "apu/resampler.h"
+#include "xalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_APU_SAMPLE_RATE (48000)
+
+// Play all four channels
+static void bench_apu_scene(gb_system_t *gb)
+{
+    const struct { uint16_t addr; byte_t value; } writes[] = {
+        {SOUND_NR52, 0x80}, {SOUND_NR50, 0x77}, {SOUND_NR51, 0xFF},
+        {SOUND_NR10, 0x00}, {SOUND_NR11, 0x80}, {SOUND_NR12, 0xF3}, {SOUND_NR13, 0x00}, {SOUND_NR14, 0x87},
+        {SOUND_NR21, 0x40}, {SOUND_NR22, 0xA0}, {SOUND_NR23, 0x80}, {SOUND_NR24, 0x86},
+        {SOUND_NR30, 0x80}, {SOUND_NR32, 0x20}, {SOUND_NR33, 0x00}, {SOUND_NR34, 0x86},
+        {SOUND_NR42, 0xF0}, {SOUND_NR43, 0x24}, {SOUND_NR44, 0x80}
+    };
+
+    for (uint16_t addr = SOUND_WAVE_PATTERN_LADDR; addr <= SOUND_WAVE_PATTERN_UADDR; ++addr)
+        sound_reg_writeb(addr, addr * 0x1F, gb);
+    for (size_t i = 0; i < sizeof(writes) / sizeof(writes[0]); ++i)
+        sound_reg_writeb(writes[i].addr, writes[i].value, gb);
+}
+
+int bench_apu(uint32_t frames)
+{
+    gb_system_t *gb = gb_system_create(false);
+    resampler_t *resampler = xalloc(sizeof(resampler_t));
+    float *resampled = xalloc(APU_SAMPLES_SIZE * sizeof(float));
+    uint64_t native = 0, samples = 0;
+    uint64_t apu_ns = 0, resampler_ns = 0, lazy_ns;
+    uint64_t start;
+
+    apu_initialize(gb);
+    resampler_init(resampler, APU_NATIVE_RATE, BENCH_APU_SAMPLE_RATE);
+    bench_apu_scene(gb);
+
+    for (uint32_t f = 0; f < frames; ++f) {
+        start = bench_now_ns();
+        gb->cycle_nb += LCD_FRAME_CYCLES;
+        apu_sync(gb);
+        apu_ns += bench_now_ns() - start;
+
+        start = bench_now_ns();
+        samples += resampler_process(resampler, gb->apu.samples, gb->apu.samples_count,
+                                     resampled, APU_SAMPLES_SIZE);
+        resampler_ns += bench_now_ns() - start;
+
+        native += gb->apu.samples_count;
+        gb->apu.samples_count = 0;
+    }
+
+    free(resampled);
+    free(resampler);
+    gb_system_destroy(gb);
+
+    // Without audio output only the guest-visible state is kept
+    gb = gb_system_create(false);
+    bench_apu_scene(gb);
+    start = bench_now_ns();
+    for (uint32_t f = 0; f < frames; ++f) {
+        gb->cycle_nb += LCD_FRAME_CYCLES;
+        apu_sync(gb);
+    }
+    lazy_ns = bench_now_ns() - start;
+    gb_system_destroy(gb);
+
+    printf("APU (%u frames, %lu samples at %u Hz)\n", frames, (unsigned long) samples, BENCH_APU_SAMPLE_RATE);
+    printf("    Native rate (%u Hz): %8.1f ns/sample\n", APU_NATIVE_RATE, (double) apu_ns / (double) native);
+    printf("    Resampling         : %8.1f ns/sample\n", (double) resampler_ns / (double) samples);
+    printf("    Total              : %8.1f ns/sample (%6.2f%% of a sample)\n",
+        (double) (apu_ns + resampler_ns) / (double) samples,
+        (double) (apu_ns + resampler_ns) / (double) samples / (1000000000.0 / BENCH_APU_SAMPLE_RATE) * 100.0);
+    printf("    No output (lazy)   : %8.1f ns/frame\n", (double) lazy_ns / (double) frames);
+    return 0;
+}
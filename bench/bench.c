@@ -0,0 +1,122 @@
+/*
+bench.c
+Benchmarks for the emulator core (no SDL required)
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+void print_usage(const char *cmd)
+{
+    printf("Usage: %s [-h] [-f frames] [-i iterations] [-j file]\n", cmd);
+    printf("       %s -s corpus [-d directory] [-B baseline] [-o file]\n"
+           "       [-r percent]\n", cmd);
+}
+
+void print_help(const char *cmd)
+{
+    print_usage(cmd);
+    printf("\nDescription:\n");
+    printf("    -h              Show this help message\n");
+    printf("    -f frames       Number of frames to render (default: 600)\n");
+    printf("                    (the APU generates the samples of as many frames)\n");
+    printf("    -i iterations   Number of times each CPU instruction is executed\n");
+    printf("                    (default: 100000)\n");
+    printf("    -j file         Write the CPU results to file in JSON\n\n");
+    printf("    -s corpus       Run the ROMs listed in corpus instead of the\n");
+    printf("                    benchmarks, one per line:\n");
+    printf("                    name rom frames [frame:button+button|frame:-]...\n");
+    printf("    -d directory    Directory of the ROMs (default: the corpus')\n");
+    printf("    -B baseline     Compare the results with baseline and fail if\n");
+    printf("                    a metric regressed\n");
+    printf("    -o file         Write the results to file (baseline format)\n");
+    printf("    -r percent      Regression threshold (default: %.0f%%)\n", BENCH_SUITE_THRESHOLD);
+}
+
+int main(int ac, char **av)
+{
+    const char shortopts[] = "hf:i:j:s:d:B:o:r:";
+    uint32_t frames = 600;
+    uint32_t iterations = 100000;
+    const char *json_file = NULL;
+    struct bench_suite_options suite = {NULL, NULL, NULL, NULL, BENCH_SUITE_THRESHOLD};
+    char *endptr;
+    int opt;
+
+    while ((opt = getopt(ac, av, shortopts)) >= 0) {
+        switch (opt) {
+            case 'h':
+                print_help(av[0]);
+                return EXIT_SUCCESS;
+
+            case 'f':
+                if ((frames = strtoul(optarg, NULL, 10)) == 0) {
+                    fprintf(stderr, "Invalid number of frames: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'i':
+                if ((iterations = strtoul(optarg, NULL, 10)) == 0) {
+                    fprintf(stderr, "Invalid number of iterations: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'j':
+                json_file = optarg;
+                break;
+
+            case 's':
+                suite.corpus = optarg;
+                break;
+
+            case 'd':
+                suite.roms_dir = optarg;
+                break;
+
+            case 'B':
+                suite.baseline = optarg;
+                break;
+
+            case 'o':
+                suite.output = optarg;
+                break;
+
+            case 'r':
+                suite.threshold = strtod(optarg, &endptr);
+                if (*endptr || suite.threshold < 0.0) {
+                    fprintf(stderr, "Invalid regression threshold: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            default: return EXIT_FAILURE;
+        }
+    }
+
+    if (suite.corpus)
+        return bench_suite(&suite) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (   bench_ppu(frames) < 0
+        || bench_apu(frames) < 0
+        || bench_cpu(iterations, json_file) < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+/*
+bench.h
+Shared definitions for the benchmarks
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdint.h>
+#include <time.h>
+
+#ifndef _BENCH_BENCH_H
+#define _BENCH_BENCH_H
+
+// Returns a monotonic timestamp in nanoseconds
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+int bench_ppu(uint32_t frames);
+int bench_apu(uint32_t frames);
+int bench_cpu(uint32_t iterations, const char *json_file);
+
+#define BENCH_SUITE_THRESHOLD (10.0) // Default regression threshold in percent
+
+struct bench_suite_options {
+    const char *corpus;     // List of the ROMs to run
+    const char *roms_dir;   // Directory of the ROMs (NULL: the corpus' directory)
+    const char *baseline;   // Results to compare with (NULL to disable)
+    const char *output;     // Write the results to this file (NULL to disable)
+    double threshold;       // A metric regresses when it is this percent worse
+};
+
+int bench_suite(const struct bench_suite_options *opts);
+
+#endif
@@ -0,0 +1,298 @@
+/*
+cpu.c
+Measure the cost of every CPU instruction
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bench.h"
+#include "gb_system.h"
+#include "cpu/cpu.h"
+#include "cpu/opcodes.h"
+#include "mmu/rombanks.h"
+#include "xalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_CPU_PC   (0x0200) // Instructions are fetched from the synthetic ROM
+#define BENCH_CPU_SP   (0xDFF0)
+#define BENCH_CPU_RUNS (3)      // The fastest run is kept
+#define BENCH_CPU_SLOWEST (5)   // Slowest instructions printed
+
+enum bench_cpu_group {
+    BENCH_CPU_LD = 0,
+    BENCH_CPU_ALU,
+    BENCH_CPU_SHIFT,
+    BENCH_CPU_BIT,
+    BENCH_CPU_JUMP,
+    BENCH_CPU_CONTROL,
+    BENCH_CPU_GROUPS
+};
+
+static const char *bench_cpu_group_names[BENCH_CPU_GROUPS] = {
+    "ld", "alu", "rotate/shift", "cb bit", "jumps/calls", "control"
+};
+
+static const struct {
+    const char *instruction;
+    enum bench_cpu_group group;
+} bench_cpu_instructions[] = {
+    {"LD", BENCH_CPU_LD}, {"LDI", BENCH_CPU_LD}, {"LDD", BENCH_CPU_LD},
+    {"LDH", BENCH_CPU_LD}, {"LDHL", BENCH_CPU_LD}, {"PUSH", BENCH_CPU_LD},
+    {"POP", BENCH_CPU_LD},
+    {"ADD", BENCH_CPU_ALU}, {"ADC", BENCH_CPU_ALU}, {"SUB", BENCH_CPU_ALU},
+    {"SBC", BENCH_CPU_ALU}, {"AND", BENCH_CPU_ALU}, {"XOR", BENCH_CPU_ALU},
+    {"OR", BENCH_CPU_ALU}, {"CP", BENCH_CPU_ALU}, {"INC", BENCH_CPU_ALU},
+    {"DEC", BENCH_CPU_ALU}, {"DAA", BENCH_CPU_ALU}, {"CPL", BENCH_CPU_ALU},
+    {"SCF", BENCH_CPU_ALU}, {"CCF", BENCH_CPU_ALU},
+    {"RLCA", BENCH_CPU_SHIFT}, {"RLA", BENCH_CPU_SHIFT}, {"RRCA", BENCH_CPU_SHIFT},
+    {"RRA", BENCH_CPU_SHIFT}, {"RLC", BENCH_CPU_SHIFT}, {"RRC", BENCH_CPU_SHIFT},
+    {"RL", BENCH_CPU_SHIFT}, {"RR", BENCH_CPU_SHIFT}, {"SLA", BENCH_CPU_SHIFT},
+    {"SRA", BENCH_CPU_SHIFT}, {"SRL", BENCH_CPU_SHIFT}, {"SWAP", BENCH_CPU_SHIFT},
+    {"BIT", BENCH_CPU_BIT}, {"RES", BENCH_CPU_BIT}, {"SET", BENCH_CPU_BIT},
+    {"JP", BENCH_CPU_JUMP}, {"JR", BENCH_CPU_JUMP}, {"CALL", BENCH_CPU_JUMP},
+    {"RET", BENCH_CPU_JUMP}, {"RETI", BENCH_CPU_JUMP}, {"RST", BENCH_CPU_JUMP}
+};
+
+// Registers before every instruction, BC, DE and HL point to WRAM and
+// C to HRAM
+static const struct cpu_regs bench_cpu_regs = {
+    .a = 0x12, .f = {.data = 0x00},
+    .b = 0xD0, .c = 0x80,
+    .d = 0xD1, .e = 0x00,
+    .h = 0xD0, .l = 0x00
+};
+
+struct bench_cpu_result {
+    const opcode_t *opcode;
+    bool cb;
+    enum bench_cpu_group group;
+    bool memory;   // Operates on (HL) or another memory operand
+    double ns;     // Per instruction
+};
+
+static enum bench_cpu_group bench_cpu_group(const char *mnemonic)
+{
+    const size_t len = strcspn(mnemonic, " ");
+
+    for (size_t i = 0; i < sizeof(bench_cpu_instructions) / sizeof(bench_cpu_instructions[0]); ++i) {
+        if (   strlen(bench_cpu_instructions[i].instruction) == len
+            && !strncmp(bench_cpu_instructions[i].instruction, mnemonic, len))
+            return bench_cpu_instructions[i].group;
+    }
+    return BENCH_CPU_CONTROL;
+}
+
+// Write the instruction to the ROM, immediate values point to WRAM (nn),
+// HRAM (n) or jump backwards (e)
+static void bench_cpu_write(const opcode_t *opcode, bool cb, gb_system_t *gb)
+{
+    byte_t *code = gb->memory.rom.banks[0] + BENCH_CPU_PC;
+
+    if (cb) {
+        code[0] = 0xCB;
+        code[1] = opcode->opcode;
+    } else {
+        code[0] = opcode->opcode;
+        code[1] = opcode->length == 3 ? 0x00 : 0x80;
+        code[2] = 0xD0;
+    }
+}
+
+// Execute the instruction iterations times from the same state
+// Returns the time per instruction in nanoseconds (fastest run)
+static double bench_cpu_opcode(const opcode_t *opcode, bool cb, uint32_t iterations, gb_system_t *gb)
+{
+    double best = 0.0;
+    uint64_t start;
+    double ns;
+
+    bench_cpu_write(opcode, cb, gb);
+    for (int run = 0; run < BENCH_CPU_RUNS; ++run) {
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < iterations; ++i) {
+            gb->regs = bench_cpu_regs;
+            gb->pc = BENCH_CPU_PC;
+            gb->sp = BENCH_CPU_SP;
+            gb->halt = false;
+            gb->stop = false;
+            gb->interrupts.ime = IME_DISABLE;
+            gb->idle_cycles = 0;
+            cpu_cycle(gb);
+        }
+        ns = (double) (bench_now_ns() - start) / (double) iterations;
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+static int bench_cpu_cmp_ns(const void *a, const void *b)
+{
+    const struct bench_cpu_result *ra = a;
+    const struct bench_cpu_result *rb = b;
+
+    return (ra->ns < rb->ns) - (ra->ns > rb->ns);
+}
+
+struct bench_cpu_average {
+    size_t count;
+    double ns;
+    size_t registers_count;
+    double registers_ns;
+    size_t memory_count;
+    double memory_ns;
+};
+
+static void bench_cpu_average(struct bench_cpu_average *avg, const struct bench_cpu_result *result)
+{
+    avg->count += 1;
+    avg->ns += result->ns;
+    if (result->memory) {
+        avg->memory_count += 1;
+        avg->memory_ns += result->ns;
+    } else {
+        avg->registers_count += 1;
+        avg->registers_ns += result->ns;
+    }
+}
+
+static inline double bench_cpu_mean(double total, size_t count)
+{
+    return count ? total / (double) count : 0.0;
+}
+
+static void bench_cpu_json_mean(FILE *file, double total, size_t count)
+{
+    if (count) {
+        fprintf(file, "%.3f", total / (double) count);
+    } else {
+        fprintf(file, "null");
+    }
+}
+
+static void bench_cpu_write_json(FILE *file, uint32_t iterations,
+    const struct bench_cpu_result *results, size_t results_nb,
+    const struct bench_cpu_average *groups, const struct bench_cpu_average *overall)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"iterations\": %u,\n", iterations);
+    fprintf(file, "  \"opcodes_count\": %zu,\n", overall->count);
+    fprintf(file, "  \"ns_per_instruction\": %.3f,\n", bench_cpu_mean(overall->ns, overall->count));
+    fprintf(file, "  \"groups\": [");
+    for (int g = 0; g < BENCH_CPU_GROUPS; ++g) {
+        fprintf(file, "%s\n    {\"group\": \"%s\", \"opcodes\": %zu, \"ns\": ",
+            g ? "," : "", bench_cpu_group_names[g], groups[g].count);
+        bench_cpu_json_mean(file, groups[g].ns, groups[g].count);
+        fprintf(file, ", \"registers_ns\": ");
+        bench_cpu_json_mean(file, groups[g].registers_ns, groups[g].registers_count);
+        fprintf(file, ", \"memory_ns\": ");
+        bench_cpu_json_mean(file, groups[g].memory_ns, groups[g].memory_count);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ],\n");
+    fprintf(file, "  \"opcodes\": [");
+    for (size_t i = 0; i < results_nb; ++i) {
+        fprintf(file, "%s\n    {\"opcode\": \"0x%s%02X\", \"mnemonic\": \"%s\", \"group\": \"%s\", \"memory\": %s, \"ns\": %.3f}",
+            i ? "," : "",
+            results[i].cb ? "CB" : "",
+            results[i].opcode->opcode,
+            results[i].opcode->mnemonic,
+            bench_cpu_group_names[results[i].group],
+            results[i].memory ? "true" : "false",
+            results[i].ns);
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+// Measure every opcode of opcode_table and opcode_cb_table through
+// cpu_cycle(), the results are also written to json_file if it is not NULL
+int bench_cpu(uint32_t iterations, const char *json_file)
+{
+    gb_system_t *gb = gb_system_create(false);
+    struct bench_cpu_result *results = xalloc(sizeof(struct bench_cpu_result) * 512);
+    struct bench_cpu_average groups[BENCH_CPU_GROUPS];
+    struct bench_cpu_average overall;
+    struct bench_cpu_result *sorted;
+    size_t results_nb = 0;
+    const opcode_t *opcode;
+    FILE *file;
+
+    // Two ROM banks without any MBC
+    rombank_alloc(2, &gb->memory.rom);
+    gb->interrupts.if_reg = 0x00;
+
+    for (int cb = 0; cb < 2; ++cb) {
+        for (int i = 0; i < 256; ++i) {
+            if (!(opcode = cb ? opcode_cb_identify(i) : opcode_identify(i)))
+                continue;
+
+            results[results_nb].opcode = opcode;
+            results[results_nb].cb = cb;
+            results[results_nb].group = bench_cpu_group(opcode->mnemonic);
+            results[results_nb].memory = strchr(opcode->mnemonic, '(')
+                                      && results[results_nb].group != BENCH_CPU_JUMP;
+            results[results_nb].ns = bench_cpu_opcode(opcode, cb, iterations, gb);
+            results_nb += 1;
+        }
+    }
+    gb_system_destroy(gb);
+
+    memset(groups, 0, sizeof(groups));
+    memset(&overall, 0, sizeof(overall));
+    for (size_t i = 0; i < results_nb; ++i) {
+        bench_cpu_average(&groups[results[i].group], &results[i]);
+        bench_cpu_average(&overall, &results[i]);
+    }
+
+    printf("CPU (%u instructions per opcode, fastest of %i runs)\n", iterations, BENCH_CPU_RUNS);
+    for (int g = 0; g < BENCH_CPU_GROUPS; ++g) {
+        printf("    %-12s: %3zu opcodes, %6.2f ns/instruction",
+            bench_cpu_group_names[g],
+            groups[g].count,
+            bench_cpu_mean(groups[g].ns, groups[g].count));
+        if (groups[g].memory_count && groups[g].registers_count) {
+            printf(" (registers %6.2f, memory %6.2f)",
+                bench_cpu_mean(groups[g].registers_ns, groups[g].registers_count),
+                bench_cpu_mean(groups[g].memory_ns, groups[g].memory_count));
+        }
+        printf("\n");
+    }
+    printf("    %-12s: %3zu opcodes, %6.2f ns/instruction\n",
+        "Overall", overall.count, bench_cpu_mean(overall.ns, overall.count));
+
+    sorted = xalloc(sizeof(struct bench_cpu_result) * results_nb);
+    memcpy(sorted, results, sizeof(struct bench_cpu_result) * results_nb);
+    qsort(sorted, results_nb, sizeof(struct bench_cpu_result), bench_cpu_cmp_ns);
+    printf("    Slowest     :");
+    for (size_t i = 0; i < results_nb && i < BENCH_CPU_SLOWEST; ++i)
+        printf("%s %s (%.2f ns)", i ? "," : "", sorted[i].opcode->mnemonic, sorted[i].ns);
+    printf("\n");
+    free(sorted);
+
+    if (json_file) {
+        if (!(file = fopen(json_file, "w"))) {
+            perror(json_file);
+            free(results);
+            return -1;
+        }
+        bench_cpu_write_json(file, iterations, results, results_nb, groups, &overall);
+        fclose(file);
+    }
+
+    free(results);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ppu.c
+Compare the cost of the scanline renderer and the pixel FIFO renderer
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bench.h"
+#include "gb_system.h"
+#include "ppu/ppu.h"
+#include "ppu/lcd_regs.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Fill VRAM and OAM with a deterministic scene using the background, the
+// window and all 40 sprites
+static void bench_ppu_scene(gb_system_t *gb)
+{
+    uint32_t seed = 0x1234567;
+
+    for (size_t i = 0; i < sizeof(gb->memory.vram); ++i) {
+        seed = seed * 1103515245 + 12345;
+        gb->memory.vram[i] = seed >> 16;
+    }
+
+    for (byte_t i = 0; i < MAX_SPRITES; ++i) {
+        gb->memory.oam[(i * 4) + 0] = 16 + ((i * 29) % SCREEN_HEIGHT);
+        gb->memory.oam[(i * 4) + 1] = 8 + ((i * 37) % SCREEN_WIDTH);
+        gb->memory.oam[(i * 4) + 2] = i;
+        gb->memory.oam[(i * 4) + 3] = (i % 4) << 5;
+    }
+    gb->screen.oam_dirty = true;
+
+    lcd_reg_writeb(LCDC_SCX, 3, gb);
+    lcd_reg_writeb(LCDC_SCY, 17, gb);
+    lcd_reg_writeb(LCDC_WY, 96, gb);
+    lcd_reg_writeb(LCDC_WX, 87, gb);
+    lcd_reg_writeb(LCDC_OBP0, 0xE4, gb);
+    lcd_reg_writeb(LCDC_OBP1, 0x1B, gb);
+    lcd_reg_writeb(LCDC_BGP, 0xE4, gb);
+    lcd_reg_writeb(LCDC, 0xF7, gb);
+}
+
+// Render frames and return the average time per frame in nanoseconds
+static double bench_ppu_renderer(const bool pixel_fifo, uint32_t frames)
+{
+    gb_system_t *gb = gb_system_create(false);
+    uint64_t start, end;
+
+    bench_ppu_scene(gb);
+    gb->screen.pixel_fifo = pixel_fifo;
+
+    // Warm up
+    for (uint32_t i = 0; i < LCD_FRAME_CYCLES * 10; ++i)
+        ppu_cycle(gb);
+
+    start = bench_now_ns();
+    for (uint32_t f = 0; f < frames; ++f) {
+        for (uint32_t i = 0; i < LCD_FRAME_CYCLES; ++i)
+            ppu_cycle(gb);
+    }
+    end = bench_now_ns();
+
+    gb_system_destroy(gb);
+    return (double) (end - start) / (double) frames;
+}
+
+int bench_ppu(uint32_t frames)
+{
+    double line_ns, fifo_ns;
+
+    line_ns = bench_ppu_renderer(false, frames);
+    fifo_ns = bench_ppu_renderer(true, frames);
+
+    printf("PPU (%u frames)\n", frames);
+    printf("    Scanline renderer: %10.0f ns/frame (%6.2f%% of a frame)\n",
+        line_ns, line_ns / (1000000000.0 * LCD_FRAME_CYCLES / CPU_CLOCK_SPEED) * 100.0);
+    printf("    Pixel FIFO       : %10.0f ns/frame (%6.2f%% of a frame)\n",
+        fifo_ns, fifo_ns / (1000000000.0 * LCD_FRAME_CYCLES / CPU_CLOCK_SPEED) * 100.0);
+    printf("    Pixel FIFO cost  : %.2fx the scanline renderer\n", fifo_ns / line_ns);
+    return 0;
+}
@@ -0,0 +1,492 @@
+/*
+suite.c
+Run a corpus of ROMs and compare the results with a baseline
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bench.h"
+#include "gb_system.h"
+#include "joypad.h"
+#include "apu/apu.h"
+#include "apu/resampler.h"
+#include "xalloc.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define SUITE_MAX_ROMS   (64)
+#define SUITE_MAX_INPUTS (32)  // Input events per ROM
+#define SUITE_NAME_SIZE  (64)
+#define SUITE_LINE_SIZE  (1024)
+#define SUITE_RUNS       (3)   // The best value of each metric is kept
+#define SUITE_AUDIO_RATE (48000) // Rate of the frontend's audio device
+
+// Buttons held from frame on (one bit per BTN_*)
+struct suite_input {
+    uint32_t frame;
+    byte_t buttons;
+};
+
+struct suite_rom {
+    char name[SUITE_NAME_SIZE];
+    char *rom;
+    uint32_t frames;
+    struct suite_input inputs[SUITE_MAX_INPUTS];
+    int inputs_nb;
+};
+
+struct suite_result {
+    char name[SUITE_NAME_SIZE];
+    bool ran;
+    double mhz;          // Emulated clock speed
+    double frame_p50;    // Frame times in milliseconds
+    double frame_p95;
+    double frame_p99;
+    double rss;          // Peak resident set size in KiB
+};
+
+// Metrics compared with the baseline
+static const struct {
+    const char *name;
+    size_t offset;
+    bool higher_is_better;
+} suite_metrics[] = {
+    {"mhz",          offsetof(struct suite_result, mhz),       true},
+    {"frame_p50_ms", offsetof(struct suite_result, frame_p50), false},
+    {"frame_p95_ms", offsetof(struct suite_result, frame_p95), false},
+    {"frame_p99_ms", offsetof(struct suite_result, frame_p99), false},
+    {"peak_rss_kb",  offsetof(struct suite_result, rss),       false}
+};
+#define SUITE_METRICS (sizeof(suite_metrics) / sizeof(suite_metrics[0]))
+
+static inline double suite_metric(const struct suite_result *result, size_t metric)
+{
+    return *(const double *) ((const char *) result + suite_metrics[metric].offset);
+}
+
+static inline double *suite_metric_ptr(struct suite_result *result, size_t metric)
+{
+    return (double *) ((char *) result + suite_metrics[metric].offset);
+}
+
+// Keep the best value of each metric in best
+static void suite_keep_best(struct suite_result *best, const struct suite_result *result)
+{
+    double value;
+
+    for (size_t m = 0; m < SUITE_METRICS; ++m) {
+        value = suite_metric(result, m);
+        if (suite_metrics[m].higher_is_better ? value > suite_metric(best, m)
+                                              : value < suite_metric(best, m))
+            *suite_metric_ptr(best, m) = value;
+    }
+}
+
+static const char *suite_button_names[8] = {
+    "up", "down", "right", "left", "a", "b", "select", "start"
+};
+
+// Parse "frame:button+button" or "frame:-" (release all the buttons)
+static bool suite_parse_input(const char *s, struct suite_input *input)
+{
+    char *endptr;
+    const char *name;
+    size_t len;
+    int b;
+
+    input->frame = strtoul(s, &endptr, 10);
+    if (endptr == s || *endptr != ':')
+        return false;
+    input->buttons = 0;
+    name = endptr + 1;
+    if (!strcmp(name, "-"))
+        return true;
+
+    while (*name) {
+        len = strcspn(name, "+");
+        for (b = 0; b < 8; ++b) {
+            if (strlen(suite_button_names[b]) == len && !strncmp(suite_button_names[b], name, len))
+                break;
+        }
+        if (b == 8)
+            return false;
+        input->buttons |= (1 << b);
+        name += len;
+        if (*name == '+')
+            name += 1;
+    }
+    return input->buttons != 0;
+}
+
+// Load the corpus, one ROM per line: name rom frames [frame:buttons...]
+// Relative ROM paths are relative to roms_dir
+// Returns the number of ROMs or -1 on error
+static int suite_load_corpus(const char *corpus, const char *roms_dir, struct suite_rom *roms)
+{
+    char line[SUITE_LINE_SIZE];
+    char *token, *save, *endptr;
+    int roms_nb = 0;
+    int line_nb = 0;
+    FILE *file;
+
+    if (!(file = fopen(corpus, "r"))) {
+        perror(corpus);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        struct suite_rom *rom = &roms[roms_nb];
+
+        line_nb += 1;
+        if (!(token = strtok_r(line, " \t\r\n", &save)) || token[0] == '#')
+            continue;
+        if (roms_nb == SUITE_MAX_ROMS) {
+            fprintf(stderr, "%s:%i: Too many ROMs (max %i)\n", corpus, line_nb, SUITE_MAX_ROMS);
+            break;
+        }
+
+        snprintf(rom->name, sizeof(rom->name), "%s", token);
+        if (!(token = strtok_r(NULL, " \t\r\n", &save)))
+            goto invalid;
+        if (token[0] == '/' || !roms_dir) {
+            rom->rom = xstrdup(token);
+        } else {
+            rom->rom = xalloc(strlen(roms_dir) + strlen(token) + 2);
+            sprintf(rom->rom, "%s/%s", roms_dir, token);
+        }
+        roms_nb += 1;
+
+        if (!(token = strtok_r(NULL, " \t\r\n", &save)))
+            goto invalid;
+        rom->frames = strtoul(token, &endptr, 10);
+        if (*endptr || rom->frames == 0)
+            goto invalid;
+
+        rom->inputs_nb = 0;
+        while ((token = strtok_r(NULL, " \t\r\n", &save))) {
+            if (rom->inputs_nb == SUITE_MAX_INPUTS || !suite_parse_input(token, &rom->inputs[rom->inputs_nb]))
+                goto invalid;
+            rom->inputs_nb += 1;
+        }
+    }
+    fclose(file);
+    return roms_nb;
+
+invalid:
+    fprintf(stderr, "%s:%i: Invalid ROM entry\n", corpus, line_nb);
+    fclose(file);
+    for (int i = 0; i < roms_nb; ++i)
+        free(roms[i].rom);
+    return -1;
+}
+
+static int suite_cmp_u64(const void *a, const void *b)
+{
+    const uint64_t ua = *(const uint64_t *) a;
+    const uint64_t ub = *(const uint64_t *) b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+static inline double suite_percentile(const uint64_t *sorted, uint32_t count, int percent)
+{
+    return (double) sorted[((size_t) (count - 1) * percent) / 100] / 1000000.0;
+}
+
+// Emulate the frames of the ROM, with the audio generated and resampled
+// after each frame as when playing
+// Returns false if the CPU stopped before the last frame
+// Runs in the child process
+static bool suite_run_rom(const struct suite_rom *rom, struct suite_result *result)
+{
+    uint64_t *frame_ns = xalloc(sizeof(uint64_t) * rom->frames);
+    resampler_t *resampler;
+    float *resampled;
+    uint64_t total_ns = 0;
+    size_t cycles = 0;
+    size_t ran = LCD_FRAME_CYCLES;
+    uint32_t frames = 0;
+    int input = 0;
+    uint64_t start;
+    gb_system_t *gb;
+
+    if (!(gb = gb_system_create_load_rom(rom->rom, false))) {
+        free(frame_ns);
+        return false;
+    }
+    apu_initialize(gb);
+    resampler = xalloc(sizeof(resampler_t));
+    resampled = xalloc(sizeof(float) * APU_SAMPLES_SIZE);
+    resampler_init(resampler, APU_NATIVE_RATE, SUITE_AUDIO_RATE);
+
+    while (frames < rom->frames && ran == LCD_FRAME_CYCLES) {
+        for (; input < rom->inputs_nb && rom->inputs[input].frame <= frames; ++input) {
+            for (byte_t b = 0; b < 8; ++b)
+                joypad_button(b, rom->inputs[input].buttons & (1 << b), gb);
+        }
+
+        start = bench_now_ns();
+        ran = gb_system_run(LCD_FRAME_CYCLES, gb);
+        apu_sync(gb);
+        resampler_process(resampler, gb->apu.samples, gb->apu.samples_count,
+                          resampled, APU_SAMPLES_SIZE);
+        gb->apu.samples_count = 0;
+        frame_ns[frames] = bench_now_ns() - start;
+
+        total_ns += frame_ns[frames];
+        cycles += ran;
+        frames += 1;
+    }
+    gb_system_destroy(gb);
+    free(resampler);
+    free(resampled);
+    if (frames < rom->frames) {
+        fprintf(stderr, "%s: The CPU stopped at frame %u of %u\n",
+            rom->name, frames, rom->frames);
+        free(frame_ns);
+        return false;
+    }
+
+    qsort(frame_ns, frames, sizeof(uint64_t), suite_cmp_u64);
+    result->mhz = (double) cycles / (double) total_ns * 1000.0;
+    result->frame_p50 = suite_percentile(frame_ns, frames, 50);
+    result->frame_p95 = suite_percentile(frame_ns, frames, 95);
+    result->frame_p99 = suite_percentile(frame_ns, frames, 99);
+    free(frame_ns);
+    return true;
+}
+
+// Run the ROM in its own process so that the peak RSS is its own and a crash
+// only fails this ROM
+// The parent must not log before forking (the logger thread is not
+// duplicated in the child)
+static bool suite_fork_rom(const struct suite_rom *rom, struct suite_result *result)
+{
+    struct rusage usage;
+    int fds[2];
+    int status;
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        result->ran = suite_run_rom(rom, result);
+        if (write(fds[1], result, sizeof(*result)) != sizeof(*result))
+            exit(EXIT_FAILURE);
+        close(fds[1]);
+        exit(result->ran ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    if (read(fds[0], result, sizeof(*result)) != sizeof(*result))
+        result->ran = false;
+    close(fds[0]);
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        result->ran = false;
+    result->rss = usage.ru_maxrss;
+    return result->ran;
+}
+
+static void suite_write_results(FILE *file, const struct suite_result *results, int results_nb)
+{
+    fprintf(file, "# name");
+    for (size_t m = 0; m < SUITE_METRICS; ++m)
+        fprintf(file, " %s", suite_metrics[m].name);
+    fprintf(file, "\n");
+
+    for (int i = 0; i < results_nb; ++i) {
+        if (!results[i].ran)
+            continue;
+        fprintf(file, "%s", results[i].name);
+        for (size_t m = 0; m < SUITE_METRICS; ++m)
+            fprintf(file, " %.3f", suite_metric(&results[i], m));
+        fprintf(file, "\n");
+    }
+}
+
+// Load results written by suite_write_results()
+// Returns the number of results or -1 on error
+static int suite_load_results(const char *filename, struct suite_result *results)
+{
+    char line[SUITE_LINE_SIZE];
+    char *token, *save, *endptr;
+    int results_nb = 0;
+    FILE *file;
+
+    if (!(file = fopen(filename, "r"))) {
+        perror(filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) && results_nb < SUITE_MAX_ROMS) {
+        struct suite_result *result = &results[results_nb];
+        size_t m;
+
+        if (!(token = strtok_r(line, " \t\r\n", &save)) || token[0] == '#')
+            continue;
+
+        memset(result, 0, sizeof(*result));
+        snprintf(result->name, sizeof(result->name), "%s", token);
+        for (m = 0; m < SUITE_METRICS && (token = strtok_r(NULL, " \t\r\n", &save)); ++m) {
+            *suite_metric_ptr(result, m) = strtod(token, &endptr);
+            if (*endptr)
+                break;
+        }
+        if (m != SUITE_METRICS) {
+            fprintf(stderr, "%s: Invalid results for '%s'\n", filename, result->name);
+            fclose(file);
+            return -1;
+        }
+        result->ran = true;
+        results_nb += 1;
+    }
+    fclose(file);
+    return results_nb;
+}
+
+// Returns the number of metrics that regressed by more than threshold percent
+static int suite_compare(const struct suite_result *baseline, int baseline_nb,
+    const struct suite_result *results, int results_nb, double threshold)
+{
+    int regressions = 0;
+    double before, after, change;
+    int i;
+
+    printf("Comparison with the baseline (threshold: %.1f%%)\n", threshold);
+    for (int b = 0; b < baseline_nb; ++b) {
+        for (i = 0; i < results_nb && strcmp(results[i].name, baseline[b].name); ++i);
+        if (i == results_nb || !results[i].ran) {
+            printf("    %-20s: REGRESSION, did not run\n", baseline[b].name);
+            regressions += 1;
+            continue;
+        }
+
+        for (size_t m = 0; m < SUITE_METRICS; ++m) {
+            before = suite_metric(&baseline[b], m);
+            after = suite_metric(&results[i], m);
+            change = before > 0.0 ? (after - before) / before * 100.0 : 0.0;
+            if (suite_metrics[m].higher_is_better)
+                change = -change;
+
+            if (change > threshold) {
+                printf("    %-20s: REGRESSION, %s %.3f -> %.3f (%+.1f%%)\n",
+                    baseline[b].name, suite_metrics[m].name, before, after,
+                    (after - before) / before * 100.0);
+                regressions += 1;
+            }
+        }
+    }
+    if (!regressions)
+        printf("    No regressions\n");
+    return regressions;
+}
+
+// Run every ROM of the corpus, write the results and compare them with the
+// baseline
+// Returns 0 on success, 1 if a ROM failed or a metric regressed, -1 on error
+int bench_suite(const struct bench_suite_options *opts)
+{
+    struct suite_rom *roms = xalloc(sizeof(struct suite_rom) * SUITE_MAX_ROMS);
+    struct suite_result *results = xzalloc(sizeof(struct suite_result) * SUITE_MAX_ROMS);
+    struct suite_result *baseline = NULL;
+    struct suite_result result;
+    char *roms_dir = opts->roms_dir ? xstrdup(opts->roms_dir) : NULL;
+    int roms_nb, baseline_nb = 0;
+    bool failed = false;
+    char *slash;
+    FILE *file;
+    int ret = -1;
+
+    // ROMs are relative to the corpus by default
+    if (!roms_dir && (slash = strrchr(opts->corpus, '/'))) {
+        roms_dir = xstrdup(opts->corpus);
+        roms_dir[slash - opts->corpus] = '\0';
+    }
+    if ((roms_nb = suite_load_corpus(opts->corpus, roms_dir, roms)) < 0)
+        goto end;
+    if (opts->baseline) {
+        baseline = xalloc(sizeof(struct suite_result) * SUITE_MAX_ROMS);
+        if ((baseline_nb = suite_load_results(opts->baseline, baseline)) < 0)
+            goto end_roms;
+    }
+
+    printf("Suite (%i ROMs, best of %i runs)\n", roms_nb, SUITE_RUNS);
+    printf("    %-20s %8s %9s %9s %9s %9s\n",
+        "ROM", "MHz", "p50 ms", "p95 ms", "p99 ms", "RSS MiB");
+    for (int i = 0; i < roms_nb; ++i) {
+        for (int run = 0; run < SUITE_RUNS; ++run) {
+            if (!suite_fork_rom(&roms[i], &result)) {
+                results[i].ran = false;
+                break;
+            }
+            if (run == 0) {
+                results[i] = result;
+            } else {
+                suite_keep_best(&results[i], &result);
+            }
+        }
+        snprintf(results[i].name, sizeof(results[i].name), "%s", roms[i].name);
+        if (!results[i].ran) {
+            printf("    %-20s FAILED (%s)\n", roms[i].name, roms[i].rom);
+            failed = true;
+            continue;
+        }
+        printf("    %-20s %8.2f %9.3f %9.3f %9.3f %9.1f\n",
+            results[i].name, results[i].mhz,
+            results[i].frame_p50, results[i].frame_p95, results[i].frame_p99,
+            results[i].rss / 1024.0);
+    }
+
+    if (opts->output) {
+        if (!(file = fopen(opts->output, "w"))) {
+            perror(opts->output);
+            goto end_roms;
+        }
+        suite_write_results(file, results, roms_nb);
+        fclose(file);
+    }
+
+    ret = failed ? 1 : 0;
+    if (baseline && suite_compare(baseline, baseline_nb, results, roms_nb, opts->threshold) > 0)
+        ret = 1;
+
+end_roms:
+    for (int i = 0; i < roms_nb; ++i)
+        free(roms[i].rom);
+end:
+    free(baseline);
+    free(roms_dir);
+    free(results);
+    free(roms);
+    return ret;
+}
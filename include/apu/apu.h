@@ -18,47 +18,41 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "gameboy.h"
-#include <math.h>
 
 #ifndef _APU_APU_H
 #define _APU_APU_H
 
-#define PI        (3.14159265358979323846)
-#define PI_HALF   (1.57079632679489661923)
+// The frame sequencer is clocked at 512 Hz, it clocks the length counters
+// at 256 Hz, the sweep at 128 Hz and the volume envelopes at 64 Hz
+#define APU_FRAME_SEQUENCER_CLOCKS (CPU_CLOCK_SPEED / 512)
 
 // Apply the volume envelope
 // vol is the 4-bit volume value
 // inc is (struct sound_volume_envelope).envelope_increase
 #define apu_volume_envelope(vol,inc) if ((inc) && (vol < 0xF)) { vol += 1; } else if (!(inc) && (vol > 0)) { vol -= 1; }
 
-// Calculate volume step in seconds
-#define apu_volume_step(n) (((double) n * (1.0 / 64.0)))
-
 // Calculate the volume percentage from 4-bit volume value
 #define apu_volume_percent(x) ((double) (x) / 15.0)
 
 // Calculate the volume percentage from 3-bit volume value
 #define apu_so_volume_percent(x)  ((double) (x) / 7.0)
 
-// Calculate sound length in seconds
-#define apu_sound_length(t1) ((double) (64 - t1) * (1.0 / 256.0))
+// Calculate sound length in length clocks
+#define apu_sound_length(t1) (64 - (t1))
 
 // Calculate the 11-bit frequency from freq_lo and freq_hi
 // nrlo is a (struct sound_freq_lo)
 // nrhi is a (struct sound_freq_hi)
 #define apu_freq11(nrlo,nrhi) (((nrhi.freq_hi) << 8) | (nrlo.freq_lo))
 
-// Calculate frequency in Hz for Tone channels 1 and 2
-#define apu_tone_freq(freq_11) (131072.0 / (2048.0 - (double) freq_11))
-
-// Calculate Wave channel sound length
-#define apu_wave_sound_length(t1) ((double) (256 - t1) * (1.0 / 256.0))
+// Calculate the duration in clocks of a duty step for Tone channels 1 and 2
+#define apu_tone_period(freq_11) ((2048 - (uint32_t) (freq_11)) * 4)
 
-// Calculate Wave channel frequency
-#define apu_wave_freq(freq_11) ((double) (65536 / (2048 - freq_11)))
+// Calculate Wave channel sound length in length clocks
+#define apu_wave_sound_length(t1) (256 - (t1))
 
-// Calculate Wave channel sample period (duration) in seconds
-#define apu_wave_period(freq) (1.0 / freq)
+// Calculate the duration in clocks of a Wave channel sample
+#define apu_wave_period(freq_11) ((2048 - (uint32_t) (freq_11)) * 2)
 
 // Return the selected 4-bit sample
 // n is the sample index (0-31)
@@ -79,13 +73,6 @@ static inline byte_t apu_wave_sample(const byte_t n,
 // Return audio sample from a 4-bit unsigned sample
 #define apu_wave_audio_sample(s) (((double) (s) - 8.0) / 8.0)
 
-static inline void ch3_update_playback_speed(gb_system_t *gb)
-{
-    gb->apu.ch3.freq = apu_wave_freq(apu_freq11(gb->apu.regs.nr33, gb->apu.regs.nr34));
-    gb->apu.ch3.period = apu_wave_period(gb->apu.ch3.freq);
-    gb->apu.ch3.wave_sample_duration = gb->apu.ch3.period / 32.0;
-}
-
 static inline void ch3_select_next_sample(gb_system_t *gb)
 {
     gb->apu.ch3.wave_sample = apu_wave_sample(gb->apu.ch3.wave_index, gb->apu.regs.wave_pattern_ram);
@@ -93,19 +80,21 @@ static inline void ch3_select_next_sample(gb_system_t *gb)
         gb->apu.ch3.wave_index = 0;
 }
 
-#define apu_noise_r(r) ((r) ? (r) : (0.5))
-#define apu_noise_freq(r,s) (524288.0 / apu_noise_r(r) / pow(2.0, (double) (s + 1)))
-
-// Generate a pulse wave sample
-static inline double pulse_sample(const double atime,
-                                  const double frequency,
-                                  const double duty)
-{
-    return sin(frequency * 2 * PI * atime) > duty ? 1.0 : -1.0;
-}
-
-void apu_lfsr_clock(gb_system_t *gb);
-double apu_generate_sample(const double atime, gb_system_t *gb);
-void apu_initialize(const uint32_t sample_rate, gb_system_t *gb);
+// Calculate the duration in clocks between two LFSR shifts of the Noise
+// channel
+#define apu_noise_period(r,s) (((r) ? ((uint32_t) (r) * 16) : 8) << (s))
+
+// The LFSR is a maximal-length sequence, its states are precomputed and
+// indexed by phase, the extra last phase is the locked all-zero state
+#define APU_LFSR15_PERIOD (32767)
+#define APU_LFSR7_PERIOD  (127)
+#define apu_lfsr_period(width7) ((width7) ? APU_LFSR7_PERIOD : APU_LFSR15_PERIOD)
+
+void apu_lfsr_set_width(gb_system_t *gb);
+void apu_sync(gb_system_t *gb);
+void apu_update_mix(gb_system_t *gb);
+void apu_trigger(const byte_t channel, gb_system_t *gb);
+void apu_initialize(gb_system_t *gb);
+void apu_enable_stems(gb_system_t *gb);
 
 #endif
\ No newline at end of file
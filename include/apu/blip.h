@@ -0,0 +1,41 @@
+/*
+blip.h
+Band-limited step synthesis
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+
+#ifndef _APU_BLIP_H
+#define _APU_BLIP_H
+
+// Impulses for each clock of a sample
+extern float blip_kernel[BLIP_PHASES][BLIP_TAPS];
+
+void blip_initialize(void);
+void blip_read_samples(struct blip_buffer *blip, float *out, const uint32_t count);
+
+// Add a step of delta at time (in clocks)
+static inline void blip_add_delta(struct blip_buffer *blip, const uint32_t time, const float delta)
+{
+    const float *kernel = blip_kernel[time % BLIP_PHASES];
+    float *deltas = &blip->deltas[time / BLIP_PHASES];
+
+    for (int i = 0; i < BLIP_TAPS; ++i)
+        deltas[i] += kernel[i] * delta;
+}
+
+#endif
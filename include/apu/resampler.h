@@ -0,0 +1,49 @@
+/*
+resampler.h
+Polyphase windowed-sinc resampler
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _APU_RESAMPLER_H
+#define _APU_RESAMPLER_H
+
+#define RESAMPLER_TAPS        (32)  // Filter length in input samples (multiple of 8)
+#define RESAMPLER_PHASES      (256) // Sub-sample positions of the filter
+#define RESAMPLER_BUFFER_SIZE (RESAMPLER_TAPS + APU_SAMPLES_SIZE)
+
+typedef struct resampler {
+    float kernel[RESAMPLER_PHASES][RESAMPLER_TAPS];
+    float input[RESAMPLER_BUFFER_SIZE]; // Input samples not consumed yet
+    size_t input_count;
+    uint64_t pos;                       // Position in input (32.32 fixed point)
+    uint64_t step;                      // Input samples per output sample (32.32 fixed point)
+    uint32_t in_rate;
+    uint32_t out_rate;
+} resampler_t;
+
+void resampler_init(resampler_t *rs, const uint32_t in_rate, const uint32_t out_rate);
+void resampler_set_ratio(resampler_t *rs, const double ratio);
+size_t resampler_process(resampler_t *rs,
+                         const float *in,
+                         size_t in_count,
+                         float *out,
+                         const size_t out_size);
+
+#endif
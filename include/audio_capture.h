@@ -0,0 +1,54 @@
+/*
+audio_capture.h
+Write audio samples to a WAV or raw file from a background thread
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ring_buffer.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef _AUDIO_CAPTURE_H
+#define _AUDIO_CAPTURE_H
+
+#define AUDIO_CAPTURE_RING_SIZE  (1 << 18) // Samples buffered for the writer
+#define AUDIO_CAPTURE_CHUNK_SIZE (4096)    // Samples written per fwrite()
+
+// Samples are pushed by the emulation thread and written by the capture
+// thread, the emulation only waits if the writer falls behind by a whole
+// ring
+typedef struct audio_capture {
+    FILE *file;
+    bool wav;                   // Write a WAV header (raw 32-bit floats otherwise)
+    uint32_t rate;
+    uint64_t written;           // Samples written to the file
+
+    ring_buffer_t ring;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t data_ready;  // Signaled by the emulation thread
+    pthread_cond_t space_ready; // Signaled by the capture thread
+    bool closing;
+    bool error;
+} audio_capture_t;
+
+audio_capture_t *audio_capture_open(const char *filename, const uint32_t rate);
+void audio_capture_write(audio_capture_t *ac, const float *samples, size_t count);
+int audio_capture_close(audio_capture_t *ac);
+
+#endif
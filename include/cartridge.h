@@ -22,6 +22,8 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #ifndef _CARTRIDGE_H
 #define _CARTRIDGE_H
 
+extern const byte_t nintendo_logo[48];
+
 char *cartridge_publisher(cartridge_hdr_t *cr);
 char *cartridge_mbc_type(cartridge_hdr_t *cr);
 bool cartridge_decode_hdr(byte_t *data, cartridge_hdr_t *cr);
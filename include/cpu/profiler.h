@@ -0,0 +1,142 @@
+/*
+profiler.h
+Guest code profiler
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdio.h>
+
+#ifndef _CPU_PROFILER_H
+#define _CPU_PROFILER_H
+
+// The hooks in the CPU are only compiled in when building with PROFILER=1,
+// otherwise they are empty and the profiler never collects anything
+
+#define PROFILER_MAX_DEPTH   (64) // Deeper calls are counted in the deepest frame
+#define PROFILER_DEFAULT_TOP (20) // Lines printed per section of the report
+
+// Instructions executed and cycles spent at one (ROM bank, PC)
+struct profiler_pc {
+    uint64_t instructions;
+    uint64_t cycles;
+};
+
+// Node of the call tree, the root (node 0) is the code outside of any call
+struct profiler_node {
+    uint32_t parent;
+    uint32_t function;   // Bank << 16 | address, | PROFILER_INTERRUPT for ISRs
+    uint64_t calls;      // Times this edge was taken from the parent
+    uint64_t cycles;     // Cycles spent in this function, not in its callees
+};
+
+#define PROFILER_INTERRUPT (1u << 31)
+#define PROFILER_ROOT      (0xFFFFFFFF)
+
+// Call currently executing, the frame is popped when SP goes above sp
+struct profiler_frame {
+    uint32_t node;
+    uint16_t sp;
+};
+
+typedef struct profiler {
+    struct profiler_pc *pcs;     // ROM banks then $8000-$FFFF
+    size_t ram_index;            // Index of $8000 in pcs
+    size_t pcs_nb;
+
+    struct profiler_node *nodes;
+    size_t nodes_nb;
+    size_t nodes_size;
+    uint32_t *children;          // Hash table of the nodes (node + 1, 0 if empty)
+    size_t children_mask;
+
+    struct profiler_frame stack[PROFILER_MAX_DEPTH];
+    int depth;
+    uint32_t node;               // Node of the current function
+    bool interrupt;              // The next call is an interrupt
+} profiler_t;
+
+void profiler_enable(gb_system_t *gb);
+void profiler_disable(gb_system_t *gb);
+void profiler_call(uint16_t addr, gb_system_t *gb);
+void profiler_ret(gb_system_t *gb);
+bool profiler_write_folded(const char *filename, gb_system_t *gb);
+void profiler_report(FILE *file, int top, gb_system_t *gb);
+
+static inline size_t profiler_index(uint16_t pc, gb_system_t *gb)
+{
+    if (pc < 0x4000)
+        return gb->memory.rom.bank_0 * 0x4000 + pc;
+    if (pc < 0x8000)
+        return gb->memory.rom.bank_n * 0x4000 + (pc - 0x4000);
+    return gb->profiler->ram_index + (pc - 0x8000);
+}
+
+// Count the instruction at pc that took cycles to execute
+static inline void profiler_on_instruction(uint16_t pc, int cycles, gb_system_t *gb)
+{
+#ifdef GB_PROFILER
+    profiler_t *profiler = gb->profiler;
+
+    if (profiler) {
+        struct profiler_pc *counter = &profiler->pcs[profiler_index(pc, gb)];
+
+        counter->instructions += 1;
+        counter->cycles += cycles;
+        profiler->nodes[profiler->node].cycles += cycles;
+    }
+#else
+    (void) pc;
+    (void) cycles;
+    (void) gb;
+#endif
+}
+
+// Called after the return address was pushed and PC set to addr
+static inline void profiler_on_call(uint16_t addr, gb_system_t *gb)
+{
+#ifdef GB_PROFILER
+    if (gb->profiler)
+        profiler_call(addr, gb);
+#else
+    (void) addr;
+    (void) gb;
+#endif
+}
+
+// Called after the return address was popped
+static inline void profiler_on_ret(gb_system_t *gb)
+{
+#ifdef GB_PROFILER
+    if (gb->profiler)
+        profiler_ret(gb);
+#else
+    (void) gb;
+#endif
+}
+
+// Called before the ISR is called
+static inline void profiler_on_interrupt(gb_system_t *gb)
+{
+#ifdef GB_PROFILER
+    if (gb->profiler)
+        gb->profiler->interrupt = true;
+#else
+    (void) gb;
+#endif
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+trace.h
+Binary trace of the instructions executed by the CPU
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdio.h>
+
+#ifndef _CPU_TRACE_H
+#define _CPU_TRACE_H
+
+#define CPU_TRACE_MAGIC        "GBTRACE"
+#define CPU_TRACE_VERSION      (1)
+#define CPU_TRACE_DEFAULT_SIZE (65536) // Instructions kept by default
+#define CPU_TRACE_CONTEXT      (8)     // Instructions printed before a divergence
+#define CPU_TRACE_LINE_SIZE    (96)    // Max length of a gameboy-doctor line
+
+// CPU state before an instruction is executed, in host byte order
+// CB-prefixed opcodes are stored as $CBxx
+struct __attribute__((packed)) cpu_trace_record {
+    uint64_t cycle;
+    uint16_t bank;   // ROM bank mapped at PC (0 outside of the ROM)
+    uint16_t pc;
+    uint16_t opcode;
+    byte_t a;
+    byte_t f;
+    byte_t b;
+    byte_t c;
+    byte_t d;
+    byte_t e;
+    byte_t h;
+    byte_t l;
+    uint16_t sp;
+};
+
+// Trace files start with this header followed by the records, oldest first
+struct __attribute__((packed)) cpu_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+// The last records are kept in a ring, when streaming each half of the ring
+// is written to the file once it is filled
+typedef struct cpu_trace {
+    struct cpu_trace_record *records;
+    size_t mask;       // Size of the ring - 1 (power of two)
+    size_t count;      // Records pushed since the trace was enabled
+    char *dump_file;   // Written on illegal opcodes and on demand (can be NULL)
+    FILE *stream;      // Every record is written to it (NULL if disabled)
+    size_t streamed;   // Records written to the stream
+
+    // gameboy-doctor logs ("A:01 F:B0 ... PC:0100 PCMEM:00,C3,13,02")
+    bool doctor;       // A log is written or compared
+    FILE *log;         // Every instruction is logged to it (NULL if disabled)
+    FILE *reference;   // Every instruction is compared with it (NULL if disabled)
+    size_t line;       // Lines compared with the reference
+    char context[CPU_TRACE_CONTEXT][CPU_TRACE_LINE_SIZE]; // Last lines that matched
+    bool diverged;     // The emulation diverged from the reference
+    bool stop;         // Stop the emulation (divergence or end of the reference)
+} cpu_trace_t;
+
+void cpu_trace_enable(size_t size, const char *dump_file, gb_system_t *gb);
+bool cpu_trace_stream(const char *filename, gb_system_t *gb);
+bool cpu_trace_dump(const char *filename, gb_system_t *gb);
+void cpu_trace_flush_stream(cpu_trace_t *trace);
+bool cpu_trace_log(const char *filename, gb_system_t *gb);
+bool cpu_trace_compare(const char *filename, gb_system_t *gb);
+void cpu_trace_doctor(const struct cpu_trace_record *record, gb_system_t *gb);
+void cpu_trace_disable(gb_system_t *gb);
+
+// Record the instruction at pc that is about to be executed
+static inline void cpu_trace_push(uint16_t pc, uint16_t opcode, gb_system_t *gb)
+{
+    cpu_trace_t *trace = gb->trace;
+    struct cpu_trace_record *record = &trace->records[trace->count & trace->mask];
+
+    record->cycle = gb->cycle_nb;
+    record->bank = pc < 0x4000 ? gb->memory.rom.bank_0
+                 : pc < 0x8000 ? gb->memory.rom.bank_n
+                 : 0;
+    record->pc = pc;
+    record->opcode = opcode;
+    record->a = gb->regs.a;
+    record->f = gb->regs.f.data;
+    record->b = gb->regs.b;
+    record->c = gb->regs.c;
+    record->d = gb->regs.d;
+    record->e = gb->regs.e;
+    record->h = gb->regs.h;
+    record->l = gb->regs.l;
+    record->sp = gb->sp;
+
+    // Write the half of the ring that was just filled
+    if ((++trace->count & (trace->mask >> 1)) == 0 && trace->stream)
+        cpu_trace_flush_stream(trace);
+    if (trace->doctor)
+        cpu_trace_doctor(record, gb);
+}
+
+#endif
@@ -44,6 +44,7 @@ struct keymap {
     SDL_Scancode emu_vol_down;
     SDL_Scancode emu_cpu_view;
     SDL_Scancode emu_mmu_view;
+    SDL_Scancode emu_trace_dump;
 };
 
 struct emu_windows {
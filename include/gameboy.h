@@ -27,6 +27,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 // Screen and sprites
 #define SCREEN_WIDTH (160)
 #define SCREEN_HEIGHT (144)
+#define SL_PADDING (8) // Sprite overflow on each side of a scanline buffer
 
 #define MAX_SPRITES (40)
 #define SPRITE_WIDTH (8)
@@ -157,7 +158,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 // LCD Definitions
 #define LCD_LINES                       (154)
-#define LCD_DMA_CYCLES                  (160)
+#define LCD_DMA_CYCLES                  (640) // 160 bytes, 1 byte per 4 clocks
 #define LCD_MODE_2_CYCLES               (80)
 #define LCD_MODE_3_CYCLES               (172) // Shortest mode 3
 #define LCD_LINE_CYCLES                 (456)
@@ -242,11 +243,25 @@ typedef struct rambank rambank_t;
 typedef struct mmu mmu_t;
 typedef struct gb_system gb_system_t;
 typedef void (*lcd_callback_t)(gb_system_t *);
-typedef void (*mbc_clock_t)(gb_system_t *);
 typedef int16_t (*mbc_readb_t)(uint16_t, gb_system_t *);
 typedef bool (*mbc_writeb_t)(uint16_t, byte_t, gb_system_t *);
 typedef struct opcode opcode_t;
 typedef int (*opcode_handler_t)(const opcode_t *, gb_system_t *);
+typedef void (*event_handler_t)(gb_system_t *);
+
+// Events scheduled at a given cycle
+enum gb_event {
+    EVENT_DMA_END = 0,  // End of an OAM DMA transfer (accurate mode)
+    EVENT_TIMA_RELOAD,  // TIMA reloaded with TMA after an overflow
+    EVENT_COUNT
+};
+
+// Clock driving the cartridge RTC
+enum rtc_source {
+    RTC_SOURCE_HOST = 0, // Host wall clock, catches up on the time spent off
+    RTC_SOURCE_EMULATED, // Emulated time only, stopped while not running
+    RTC_SOURCE_FIXED     // Emulated time starting from a fixed epoch
+};
 
 // Structures
 struct pixel {
@@ -292,6 +307,33 @@ struct __attribute__((packed)) lcd_stat_reg {
     byte_t _padding        : 1;
 };
 
+struct ppu_fifo {
+    // Background/Window FIFO (bit planes shifted out from bit 7)
+    byte_t bg_lo;
+    byte_t bg_hi;
+    byte_t bg_size;
+
+    // Sprite FIFO, slot (obj_head + n) holds the sprite pixel that will be
+    // mixed with the n-th next background pixel
+    byte_t obj_shade_id[8];       // 0 == transparent
+    byte_t obj_attr[8];           // Bit 0: OBP1, Bit 1: behind background
+    byte_t obj_head;
+    byte_t obj_index;             // Next entry of oam_sorted to fetch
+
+    // Background/Window fetcher
+    byte_t fetch_dots;            // Dots spent on the current tile fetch
+    byte_t fetch_x;               // Tile column fetched
+    byte_t tile_id;
+    byte_t tile_lo;
+    byte_t tile_hi;
+    bool window;                  // Fetching window tiles
+
+    byte_t lx;                    // X position of the next pixel to output
+    byte_t discard;               // Pixels to discard (fine scrolling)
+    uint16_t stall;               // Dots to wait before resuming
+    bool done;                    // All pixels of the scanline were output
+};
+
 struct lcd_screen {
     struct lcdc_reg lcdc;
     struct lcd_stat_reg lcd_stat;
@@ -309,24 +351,31 @@ struct lcd_screen {
     byte_t obp0;    // Object Palette 0 Data
     byte_t obp1;    // Object Palette 1 Data
 
-    // OAM buffer to fill during mode 2
-    byte_t oam_search_index;
-    oam_entry_t oam_buffer[10];
+    // Sprites selected for the current scanline during mode 2
     oam_entry_t *oam_sorted[10];
     byte_t oam_buffer_size;
 
+    // OAM indexes of the sprites visible on each scanline sorted by
+    // priority, rebuilt when sprite positions or the sprite size change
+    byte_t oam_lines[SCREEN_HEIGHT][10];
+    byte_t oam_lines_size[SCREEN_HEIGHT];
+    bool oam_dirty;
+
     // DMA
     byte_t dma;                     // DMA Transfer
     uint16_t dma_src;               // DMA Source Address
-    byte_t dma_offset;              // DMA Address Offset
-    byte_t dma_running;             // DMA Transfer Remaining Cycles
+    bool dma_running;               // DMA Transfer in progress (accurate mode)
+    bool dma_accurate;              // Only copy the OAM at the end of the transfer
+                                    // and block the CPU bus until then
 
     // Screen framebuffer to hold the pixels
     pixel_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
 
-    // Rendering buffers
-    byte_t sl_bg_shade_id[SCREEN_WIDTH];
-    sbyte_t sl_sprite_shade_id[SCREEN_WIDTH];
+    // Rendering buffers, pixel x is stored at index x + SL_PADDING so that
+    // sprites partially off-screen can be drawn without clipping
+    byte_t sl_bg_shade_id[SL_PADDING + SCREEN_WIDTH + SL_PADDING];
+    sbyte_t sl_sprite_shade_id[SL_PADDING + SCREEN_WIDTH + SL_PADDING];
+    byte_t sl_sprite_shade[SL_PADDING + SCREEN_WIDTH + SL_PADDING];
 
     // Callback function called when the PPU enters the V-Blank period
     // (after a full frame is drawn)
@@ -335,6 +384,15 @@ struct lcd_screen {
     // LCD State
     byte_t window_scanline;
     uint32_t scanline_clock;
+
+    // Pixel FIFO renderer (mode 3 is emulated dot by dot with a variable
+    // length instead of drawing whole scanlines at once)
+    bool pixel_fifo;
+    struct ppu_fifo fifo;
+
+    // LY always reads $90, like the emulators that generate gameboy-doctor
+    // reference logs
+    bool ly_stub;
 };
 
 struct __attribute__((packed)) sound_volume_envelope {
@@ -464,48 +522,72 @@ struct sound_regs {
     struct sound_nr52 nr52;
 };
 
+// The APU generates samples at its native rate, they are resampled to the
+// output rate by the frontend
+#define APU_NATIVE_CLOCKS (32)                                  // Clocks per sample
+#define APU_NATIVE_RATE   (CPU_CLOCK_SPEED / APU_NATIVE_CLOCKS) // 131072 Hz
+#define APU_SAMPLES_SIZE  (8192)                                // Samples generated but not yet read
+
+// Band-limited step synthesis
+#define BLIP_TAPS        (16)                // Width of the impulses in samples
+#define BLIP_PHASES      (APU_NATIVE_CLOCKS) // Sub-sample resolution of the steps (1 clock)
+#define BLIP_BUFFER_SIZE (APU_SAMPLES_SIZE + BLIP_TAPS)
+
+// Steps are added at a time in clocks relative to the first sample that
+// was not read yet
+struct blip_buffer {
+    float deltas[BLIP_BUFFER_SIZE];
+    float sum;
+};
+
+// Each channel rendered separately, the samples are stored along with the
+// mixed samples and share their samples_count
+struct apu_stems {
+    struct blip_buffer blip[4];
+    float amp[4];
+    float samples[4][APU_SAMPLES_SIZE];
+};
+
+// The frequency timers count down emulated clocks, the channels' output
+// only changes when they reach 0
+// The length counters, volume envelopes and sweep are clocked by the frame
+// sequencer
 struct sound_channel_1 {
-    double stop_at;
-    double duty;
-    double length;
     byte_t volume : 4;
-    double volume_step;
-    double next_volume_step;
-    uint16_t freq11;
-    double freq;
-    double sweep;
-    double next_sweep;
+    byte_t envelope_timer;  // Envelope clocks left before the next volume step
+    uint16_t length;        // Length clocks left before the channel stops
+    uint16_t freq11;        // Sweep shadow frequency
+    byte_t sweep_timer;     // Sweep clocks left before the next sweep
+    uint32_t timer;         // Clocks left before the next duty step
+    byte_t duty_pos;        // Position in the duty cycle (0-7)
+    float out;
 };
 
 struct sound_channel_2 {
-    double stop_at;
-    double duty;
-    double length;
     byte_t volume : 4;
-    double volume_step;
-    double next_volume_step;
-    double freq;
+    byte_t envelope_timer;
+    uint16_t length;
+    uint32_t timer;
+    byte_t duty_pos;
+    float out;
 };
 
 struct sound_channel_3 {
-    double stop_at;
-    double length;
-    double freq;
-    double period;
+    uint16_t length;
     byte_t wave_index;
     byte_t wave_sample;
-    double wave_sample_duration;
-    double time_elapsed;
-    byte_t sample_out;
+    uint32_t timer;         // Clocks left before the next wave sample
+    float out;
 };
 
 struct sound_channel_4 {
-    double stop_at;
-    double length;
     byte_t volume : 4;
-    double volume_step;
-    double next_volume_step;
-    double freq;
+    byte_t envelope_timer;
+    uint16_t length;
+    uint32_t timer;         // Clocks left before the next LFSR shift
+    uint16_t lfsr_phase;    // Position in the LFSR sequence of lfsr_width7
+    bool lfsr_width7;       // Counter width the phase refers to
+    float out;
 };
 
 struct apu {
@@ -514,10 +596,23 @@ struct apu {
     struct sound_channel_2 ch2;
     struct sound_channel_3 ch3;
     struct sound_channel_4 ch4;
-    uint16_t lfsr : 15;
 
-    uint32_t sample_rate;
-    double sample_duration;
+    // The APU is only emulated up to gb->cycle_nb when its state is needed
+    // (register accesses or reading the samples)
+    size_t cycle;                // Cycle up to which the APU was emulated
+    uint32_t fs_timer;           // Clocks left before the next frame sequencer step
+    byte_t fs_step;              // Frame sequencer step (0-7)
+
+    // Output at APU_NATIVE_RATE (disabled by default)
+    bool output;
+    uint32_t blip_time;          // Clocks since the start of the first sample
+                                 // not read from the blip buffer
+    float gains[4];              // Mixing gain of each channel
+    float amp;                   // Current mixed output level
+    struct blip_buffer blip;
+    float samples[APU_SAMPLES_SIZE];
+    uint32_t samples_count;
+    struct apu_stems *stems;     // Output of each channel (NULL if disabled)
 };
 
 struct  __attribute__((packed)) serial_reg_sc {
@@ -536,10 +631,12 @@ struct serial_port {
     byte_t sb;
     struct serial_reg_sc sc;
 
+    byte_t sb_out;            // Byte shifted out during transfers
     byte_t shifts;            // # of shifts left
-    uint32_t clock_speed;     // Serial Transfer clock speed (internal or external)
+    uint32_t clock_speed;     // Serial Transfer clock speed (internal clock only)
     uint32_t shift_clock;     // # of remaining clocks before shifting
-    bool plugged;             // Link Cable plugged
+    struct link *link;        // Link Cable plugged (NULL if not plugged)
+    struct serial_sink *sink; // Capture of the bytes sent (NULL if disabled)
 };
 
 struct joypad {
@@ -602,7 +699,8 @@ struct mmu {
     size_t mbc_regs_size;        // Size of the data pointed by *mbc_regs
     mbc_readb_t mbc_readb;       // mbc_readb function pointer
     mbc_writeb_t mbc_writeb;     // mbc_writeb function pointer
-    mbc_clock_t mbc_clock;       // mbc_clock function pointer
+    enum rtc_source rtc_source;  // Clock driving the cartridge RTC
+    int64_t rtc_epoch;           // Time at power on for RTC_SOURCE_FIXED
 };
 
 struct interrupts {
@@ -626,6 +724,16 @@ struct timer {
     uint16_t counter;     // Timer Counter
     byte_t tima_overflow; // TIMA Overflow Clocks
     uint16_t tima_clock;  // TIMA Clock Select (divider)
+
+    // The timer is only emulated up to gb->cycle_nb when its registers
+    // are accessed, the TIMA reload is a scheduled event
+    size_t cycle;         // Next cycle # to emulate
+};
+
+struct scheduler {
+    size_t next;            // Cycle # of the next event
+    size_t at[EVENT_COUNT]; // Cycle # at which each event happens
+                            // (SCHEDULER_NEVER if it is not scheduled)
 };
 
 struct __attribute__((packed)) cpu_flags {
@@ -661,13 +769,17 @@ struct gb_system {
     struct timer timer;                // Built-in GameBoy timer
     struct joypad joypad;              // Joypad
     struct serial_port serial;         // Serial Port
+    struct scheduler scheduler;        // Scheduled events
     struct cpu_regs regs;              // CPU Registers
     bool halt;                         // HALT (CPU halted until interrupt)
     bool stop;                         // STOP (CPU and LCD halted until button press)
+    bool breakpoint;                   // Set when LD B,B is executed (software breakpoint)
     uint16_t pc;                       // Program Counter (Initialized with CARTRIDGE_HEADER_LADDR)
     uint16_t sp;                       // Stack pointer (Initialized with HRAM_UADDR)
     uint16_t idle_cycles;              // Remaining cycles to idle (decrease at every cycle)
     size_t cycle_nb;                   // CPU Cycle #
+    struct cpu_trace *trace;           // Trace of the last instructions (NULL if disabled)
+    struct profiler *profiler;         // Guest code profiler (NULL if disabled)
 };
 
 struct opcode {
@@ -26,6 +26,8 @@ byte_t *load_file(const char *filename, int *size);
 int load_rom(byte_t *rom, int size, gb_system_t *gb);
 int load_rom_from_file(const char *filename, gb_system_t *gb);
 void gb_system_reset(bool enable_bootrom, gb_system_t *gb);
+size_t gb_system_run(size_t clocks, gb_system_t *gb);
+size_t gb_system_run_pair(size_t clocks, gb_system_t *gb1, gb_system_t *gb2);
 void gb_system_destroy(gb_system_t *gb);
 gb_system_t *gb_system_create(bool enable_bootrom);
 gb_system_t *gb_system_create_load_rom(const char *filename, bool enable_bootrom);
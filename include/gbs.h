@@ -0,0 +1,54 @@
+/*
+gbs.h
+GBS (GameBoy Sound) music files
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stddef.h>
+
+#ifndef _GBS_H
+#define _GBS_H
+
+#define GBS_HEADER_SIZE      (0x70)
+#define GBS_MIN_LOAD_ADDR    (0x0400) // Below is the player's code
+#define GBS_MAX_ROM_BANKS    (256)    // Banks selected by an 8-bit write to $2000
+#define GBS_DEFAULT_SECONDS  (150.0)  // Length of a track if not specified
+
+// The play routine is called from the timer interrupt if bit 2 of TAC is
+// set, from the V-Blank interrupt otherwise
+typedef struct gbs {
+    byte_t songs;         // Number of songs
+    byte_t first_song;    // Default song (1-based)
+    uint16_t load_addr;   // Address where the data is loaded
+    uint16_t init_addr;   // Init routine, called with the song (0-based) in A
+    uint16_t play_addr;   // Play routine, called at the playback rate
+    uint16_t sp;          // Initial stack pointer
+    byte_t tma;           // Timer modulo
+    byte_t tac;           // Timer control
+    char title[33];
+    char author[33];
+    char copyright[33];
+    byte_t *data;
+    size_t data_size;
+} gbs_t;
+
+gbs_t *gbs_load_file(const char *filename);
+void gbs_destroy(gbs_t *gbs);
+gb_system_t *gbs_create_system(const gbs_t *gbs, const byte_t song);
+size_t gbs_run(size_t clocks, gb_system_t *gb);
+
+#endif
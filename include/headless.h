@@ -0,0 +1,42 @@
+/*
+headless.h
+Emulate without a window or audio device, as fast as possible
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef _HEADLESS_H
+#define _HEADLESS_H
+
+#define HEADLESS_AUDIO_RATE (48000) // Sample rate of the captured audio
+
+struct headless_options {
+    double seconds;           // Emulated time to run for
+    const char *audio_file;   // Capture the audio to this file (NULL to disable)
+    bool audio_stems;         // Also capture each channel to its own file
+
+    // Emulates clocks cycles, returns the number of cycles emulated
+    // (gb_system_run() if NULL)
+    size_t (*run)(size_t clocks, gb_system_t *gb);
+};
+
+char *headless_filename(const char *filename, const char *tag);
+int emulate_headless(const struct headless_options *opts, gb_system_t *gb);
+
+#endif
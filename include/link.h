@@ -0,0 +1,74 @@
+/*
+link.h
+Link cable between two emulators
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#ifndef _LINK_H
+#define _LINK_H
+
+#define LINK_CHANNEL_SIZE   (64)  // Messages queued in each direction (power of 2)
+#define LINK_TIMEOUT_MS     (100) // Max time to wait for the other process to create the link
+#define LINK_CONNECT_MS     (30000) // Max time to wait for the other process to open the link
+#define LINK_TIMEOUT_CLOCKS (CPU_CLOCK_SPEED / 10) // Max emulated time to wait for a reply
+
+typedef struct link link_t;
+
+enum link_type {
+    LINK_LOCAL = 0, // Other GameBoy emulated in the same thread
+    LINK_SHM        // Other emulator process, over shared memory
+};
+
+// Messages written by one side and read by the other, head and tail are
+// free-running counters
+struct link_channel {
+    atomic_size_t head; // Written by the producer
+    atomic_size_t tail; // Written by the consumer
+    uint32_t msgs[LINK_CHANNEL_SIZE];
+};
+
+// Shared memory object mapped by both processes
+// pending[side] is the sequence # of the transfer started by side that was
+// not answered yet (0 if none), the other side claims it before answering
+// and side claims it to cancel it, so that only one of them can
+struct link_shm {
+    atomic_int sides; // Number of processes that opened it
+    atomic_uint pending[2];
+    struct link_channel channels[2];
+};
+
+struct link {
+    enum link_type type;
+    gb_system_t *peer;     // Other GameBoy (LINK_LOCAL)
+    struct link_shm *shm;  // Shared memory (LINK_SHM)
+    char *shm_name;        // Name of the shared memory object
+    int side;              // Index of the channel written by this side
+    uint16_t seq;          // Sequence # of the last transfer started (never 0)
+    size_t deadline;       // Cycle # at which the transfer is cancelled
+};
+
+void link_plug_local(gb_system_t *gb1, gb_system_t *gb2);
+bool link_plug_shm(const char *name, gb_system_t *gb);
+void link_unplug(gb_system_t *gb);
+void link_transfer_start(byte_t out, gb_system_t *gb);
+bool link_transfer_end(byte_t out, byte_t *in, gb_system_t *gb);
+void link_poll(gb_system_t *gb);
+
+#endif
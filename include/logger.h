@@ -36,6 +36,8 @@ typedef enum loglevel {
 } loglevel_t;
 
 bool logger_set_level_name(const char *level_name);
+void logger_set_instance(int id);
+void logger_flush(void);
 
 _logger_attr
 void logger(loglevel_t level, const char *format, ...);
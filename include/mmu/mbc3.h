@@ -55,12 +55,14 @@ struct mbc3_regs {
     struct rtc_regs latch;
     byte_t latch_reg;
     byte_t ram_bank;
-    size_t clocks;
-    time_t last_tick;
+    size_t clocks;    // Clocks elapsed in the current RTC second
+    size_t cycle;     // Cycle # up to which the RTC was emulated
+    time_t last_tick; // Time of the last RTC tick from the RTC source
+    time_t base;      // Time at cycle 0 for RTC_SOURCE_EMULATED
 };
 
-void mbc3_rtc_tick_timestamp(gb_system_t *gb);
-void mbc3_clock(gb_system_t *gb);
+void mbc3_rtc_tick_timestamp(enum rtc_source saved_source, gb_system_t *gb);
+void mbc3_rtc_sync(gb_system_t *gb);
 int16_t mbc3_readb(uint16_t addr, gb_system_t *gb);
 bool mbc3_writeb(uint16_t addr, byte_t value, gb_system_t *gb);
 
@@ -22,6 +22,8 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #ifndef _PPU_PPU_H
 #define _PPU_PPU_H
 
+void ppu_dma_transfer(gb_system_t *gb);
+void ppu_dma_end(gb_system_t *gb);
 int ppu_cycle(gb_system_t *gb);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+ring_buffer.h
+Lock-free single-producer/single-consumer ring buffer
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#ifndef _RING_BUFFER_H
+#define _RING_BUFFER_H
+
+// Elements are copied in and out by value, one thread may only push and the
+// other may only pop
+// head and tail are free-running counters, the capacity is a power of two so
+// that they can be wrapped with a mask
+typedef struct ring_buffer {
+    unsigned char *data;
+    size_t elem_size;
+    size_t capacity;
+    size_t mask;
+    atomic_size_t head; // Written by the producer
+    atomic_size_t tail; // Written by the consumer
+} ring_buffer_t;
+
+void ring_buffer_init(ring_buffer_t *rb, const size_t elem_size, size_t capacity);
+void ring_buffer_free(ring_buffer_t *rb);
+size_t ring_buffer_push(ring_buffer_t *rb, const void *src, size_t count);
+size_t ring_buffer_pop(ring_buffer_t *rb, void *dest, size_t count);
+
+// Returns the number of elements that can be popped
+// From the other thread this is only a snapshot
+static inline size_t ring_buffer_count(ring_buffer_t *rb)
+{
+    return atomic_load_explicit(&rb->head, memory_order_acquire)
+         - atomic_load_explicit(&rb->tail, memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,40 @@
+/*
+scheduler.h
+Function prototypes for scheduler.c
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdint.h>
+
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#define SCHEDULER_NEVER (SIZE_MAX)
+
+void scheduler_reset(gb_system_t *gb);
+void scheduler_add(enum gb_event event, size_t cycle, gb_system_t *gb);
+void scheduler_remove(enum gb_event event, gb_system_t *gb);
+void scheduler_run(gb_system_t *gb);
+
+// Run the events that are due at the current cycle
+static inline void scheduler_cycle(gb_system_t *gb)
+{
+    if (gb->cycle_nb >= gb->scheduler.next)
+        scheduler_run(gb);
+}
+
+#endif
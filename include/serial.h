@@ -24,6 +24,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 byte_t serial_reg_readb(uint16_t addr, gb_system_t *gb);
 bool serial_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb);
+void serial_transfer_end(byte_t in, gb_system_t *gb);
 void serial_cycle(gb_system_t *gb);
 
 #endif
\ No newline at end of file
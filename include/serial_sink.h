@@ -0,0 +1,56 @@
+/*
+serial_sink.h
+Capture of the bytes sent over the serial port
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifndef _SERIAL_SINK_H
+#define _SERIAL_SINK_H
+
+#define SERIAL_SINK_PATTERNS   (4)         // Max number of stop patterns
+#define SERIAL_SINK_WINDOW     (64)        // Max length of a stop pattern
+#define SERIAL_SINK_FILE_BUFFER (1 << 16)  // stdio buffer of the output file
+
+// Every byte sent by a completed transfer is appended to a caller buffer
+// and/or a file, the output is also matched against stop patterns
+typedef struct serial_sink {
+    byte_t *buffer;       // Caller buffer (NULL if none)
+    size_t capacity;      // Size of the caller buffer
+    size_t size;          // Bytes written to the caller buffer
+    size_t total;         // Bytes received (may exceed capacity)
+
+    FILE *file;           // Output file (NULL if none)
+    bool close_file;      // The file was opened by the sink
+
+    const char *patterns[SERIAL_SINK_PATTERNS];
+    size_t patterns_len[SERIAL_SINK_PATTERNS];
+    int patterns_nb;
+    byte_t window[SERIAL_SINK_WINDOW]; // Last bytes received
+    int matched;          // Index of the pattern that matched (-1 if none)
+} serial_sink_t;
+
+serial_sink_t *serial_sink_create(byte_t *buffer, size_t capacity);
+bool serial_sink_open(serial_sink_t *sink, const char *filename);
+bool serial_sink_stop_on(serial_sink_t *sink, const char *pattern);
+void serial_sink_write(serial_sink_t *sink, byte_t value);
+void serial_sink_destroy(serial_sink_t *sink);
+
+#endif
@@ -24,6 +24,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 byte_t timer_reg_readb(uint16_t addr, gb_system_t *gb);
 bool timer_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb);
-void timer_cycle(gb_system_t *gb);
+void timer_sync(gb_system_t *gb);
+void timer_tima_reload(gb_system_t *gb);
 
 #endif
\ No newline at end of file
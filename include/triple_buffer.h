@@ -0,0 +1,64 @@
+/*
+triple_buffer.h
+Lock-free triple buffer to pass frames between two threads
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#ifndef _TRIPLE_BUFFER_H
+#define _TRIPLE_BUFFER_H
+
+typedef pixel_t frame_t[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+// The producer always owns the back frame and the consumer the front frame,
+// the middle frame is swapped atomically by either of them
+// The producer never waits, it overwrites the middle frame if the consumer
+// did not pick it up yet
+typedef struct triple_buffer {
+    frame_t frames[3];
+    atomic_uint middle; // Index of the middle frame | TRIPLE_BUFFER_FRESH
+    unsigned int back;  // Producer only
+    unsigned int front; // Consumer only
+} triple_buffer_t;
+
+#define TRIPLE_BUFFER_FRESH (1 << 2) // The middle frame was not consumed yet
+
+void triple_buffer_init(triple_buffer_t *tb);
+bool triple_buffer_acquire(triple_buffer_t *tb);
+
+// Returns the frame to be written by the producer
+static inline frame_t *triple_buffer_back(triple_buffer_t *tb)
+{
+    return &tb->frames[tb->back];
+}
+
+// Returns the latest frame acquired by the consumer
+static inline const frame_t *triple_buffer_front(const triple_buffer_t *tb)
+{
+    return &tb->frames[tb->front];
+}
+
+// Publish the back frame
+static inline void triple_buffer_publish(triple_buffer_t *tb)
+{
+    tb->back = atomic_exchange_explicit(&tb->middle,
+        tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel) & 0x3;
+}
+
+#endif
@@ -24,6 +24,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 void *xalloc(size_t size);
 void *xzalloc(size_t size);
+void *xrealloc(void *ptr, size_t size);
 char *xstrdup(const char *s);
 
 #endif
\ No newline at end of file
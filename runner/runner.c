@@ -0,0 +1,408 @@
+/*
+runner.c
+Runs test ROMs in parallel and reports their results (no SDL required)
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "gb_system.h"
+#include "serial_sink.h"
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNNER_SERIAL_SIZE     (4096) // Serial output kept for the report
+#define RUNNER_DEFAULT_SECONDS (120.0)
+
+enum runner_status {
+    RUNNER_PASS = 0,
+    RUNNER_FAIL,
+    RUNNER_TIMEOUT,
+    RUNNER_ERROR
+};
+
+static const char *runner_status_names[] = {"pass", "fail", "timeout", "error"};
+
+struct runner_result {
+    char *rom;
+    enum runner_status status;
+    const char *detection;  // What decided the status (NULL if nothing did)
+    size_t cycles;          // Cycles emulated
+    double seconds;         // Wall time
+    byte_t serial[RUNNER_SERIAL_SIZE];
+    size_t serial_size;
+};
+
+struct runner {
+    struct runner_result *results;
+    size_t count;
+    size_t capacity;
+    atomic_size_t next;     // Index of the next ROM to run
+    size_t max_cycles;      // Timeout of each ROM
+};
+
+// Returns a monotonic time in seconds
+static double runner_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+static void runner_add_rom(struct runner *runner, const char *path)
+{
+    if (runner->count == runner->capacity) {
+        runner->capacity = runner->capacity ? runner->capacity * 2 : 64;
+        runner->results = xrealloc(runner->results, sizeof(struct runner_result) * runner->capacity);
+    }
+    // A ROM that is never run is reported as an error, not as passed
+    memset(&runner->results[runner->count], 0, sizeof(struct runner_result));
+    runner->results[runner->count].status = RUNNER_ERROR;
+    runner->results[runner->count].rom = xstrdup(path);
+    runner->count += 1;
+}
+
+static bool runner_is_rom(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    return ext && (!strcasecmp(ext, ".gb") || !strcasecmp(ext, ".gbc"));
+}
+
+// Add path if it is a ROM, or all the ROMs in it if it is a directory
+// Returns false on error
+static bool runner_scan(struct runner *runner, const char *path)
+{
+    struct dirent *entry;
+    struct stat st;
+    char *subpath;
+    bool ret = true;
+    DIR *dir;
+
+    if (stat(path, &st) < 0) {
+        perror(path);
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        runner_add_rom(runner, path);
+        return true;
+    }
+    if (!(dir = opendir(path))) {
+        perror(path);
+        return false;
+    }
+
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        subpath = xalloc(strlen(path) + strlen(entry->d_name) + 2);
+        sprintf(subpath, "%s/%s", path, entry->d_name);
+        if (stat(subpath, &st) == 0 && S_ISDIR(st.st_mode))
+            ret = runner_scan(runner, subpath) && ret;
+        else if (runner_is_rom(subpath))
+            runner_add_rom(runner, subpath);
+        free(subpath);
+    }
+    closedir(dir);
+    return ret;
+}
+
+static int runner_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct runner_result *) a)->rom,
+                  ((const struct runner_result *) b)->rom);
+}
+
+// Mooneye test ROMs execute LD B,B with the Fibonacci numbers in the
+// registers when they pass, and with 0x42 in all of them when they fail
+// Returns the status, or -1 if the registers hold none of these signatures
+static int runner_mooneye_status(gb_system_t *gb)
+{
+    if (   gb->regs.b == 3  && gb->regs.c == 5  && gb->regs.d == 8
+        && gb->regs.e == 13 && gb->regs.h == 21 && gb->regs.l == 34)
+        return RUNNER_PASS;
+    if (   gb->regs.b == 0x42 && gb->regs.c == 0x42 && gb->regs.d == 0x42
+        && gb->regs.e == 0x42 && gb->regs.h == 0x42 && gb->regs.l == 0x42)
+        return RUNNER_FAIL;
+    return -1;
+}
+
+// Run a ROM until it reports its result or times out
+static void runner_run_rom(struct runner_result *result, const size_t max_cycles)
+{
+    const double start = runner_now();
+    serial_sink_t *sink;
+    gb_system_t *gb;
+    size_t clocks, ran;
+    int status;
+
+    result->status = RUNNER_ERROR;
+    if (!(gb = gb_system_create_load_rom(result->rom, false))) {
+        result->detection = "load";
+        return;
+    }
+
+    // Blargg's test ROMs print their result over the serial port
+    sink = serial_sink_create(result->serial, RUNNER_SERIAL_SIZE);
+    serial_sink_stop_on(sink, "Passed");
+    serial_sink_stop_on(sink, "Failed");
+    gb->serial.sink = sink;
+
+    result->status = RUNNER_TIMEOUT;
+    while (result->cycles < max_cycles) {
+        clocks = max_cycles - result->cycles;
+        if (clocks > LCD_FRAME_CYCLES)
+            clocks = LCD_FRAME_CYCLES;
+        ran = gb_system_run(clocks, gb);
+        result->cycles += ran;
+
+        if (sink->matched >= 0) {
+            result->status = sink->matched == 0 ? RUNNER_PASS : RUNNER_FAIL;
+            result->detection = "serial";
+            break;
+        }
+        if (gb->breakpoint) {
+            gb->breakpoint = false;
+            if ((status = runner_mooneye_status(gb)) >= 0) {
+                result->status = status;
+                result->detection = "mooneye";
+                break;
+            }
+        }
+        if (ran < clocks) {
+            result->status = RUNNER_ERROR;
+            result->detection = "cpu";
+            break;
+        }
+    }
+
+    result->serial_size = sink->size;
+    result->seconds = runner_now() - start;
+    serial_sink_destroy(sink);
+    gb_system_destroy(gb);
+}
+
+static void *runner_thread(void *data)
+{
+    struct runner *runner = (struct runner *) data;
+    struct runner_result *result;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&runner->next, 1)) < runner->count) {
+        result = &runner->results[i];
+        logger_set_instance((int) i);
+        runner_run_rom(result, runner->max_cycles);
+        fprintf(stderr, "[%-7s] %s (%.2fs)\n",
+            runner_status_names[result->status], result->rom, result->seconds);
+    }
+    return NULL;
+}
+
+static void runner_json_string(FILE *file, const char *s, size_t len)
+{
+    fputc('"', file);
+    for (size_t i = 0; i < len; ++i) {
+        switch (s[i]) {
+            case '"' : fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '\n': fputs("\\n", file); break;
+            case '\r': fputs("\\r", file); break;
+            case '\t': fputs("\\t", file); break;
+            default:
+                if ((unsigned char) s[i] < 0x20 || (unsigned char) s[i] >= 0x7F)
+                    fprintf(file, "\\u%04x", (unsigned char) s[i]);
+                else
+                    fputc(s[i], file);
+                break;
+        }
+    }
+    fputc('"', file);
+}
+
+static void runner_write_json(FILE *file, const struct runner *runner,
+    const int jobs, const double seconds)
+{
+    size_t counts[RUNNER_ERROR + 1] = {0};
+    const struct runner_result *result;
+
+    for (size_t i = 0; i < runner->count; ++i)
+        counts[runner->results[i].status] += 1;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"total\": %zu,\n", runner->count);
+    for (int i = 0; i <= RUNNER_ERROR; ++i)
+        fprintf(file, "  \"%s\": %zu,\n", runner_status_names[i], counts[i]);
+    fprintf(file, "  \"jobs\": %d,\n", jobs);
+    fprintf(file, "  \"seconds\": %.3f,\n", seconds);
+    fprintf(file, "  \"roms\": [");
+    for (size_t i = 0; i < runner->count; ++i) {
+        result = &runner->results[i];
+        fprintf(file, "%s\n    {\"rom\": ", i ? "," : "");
+        runner_json_string(file, result->rom, strlen(result->rom));
+        fprintf(file, ", \"status\": \"%s\"", runner_status_names[result->status]);
+        fprintf(file, ", \"detection\": ");
+        if (result->detection)
+            runner_json_string(file, result->detection, strlen(result->detection));
+        else
+            fprintf(file, "null");
+        fprintf(file, ", \"cycles\": %zu", result->cycles);
+        fprintf(file, ", \"emulated_seconds\": %.3f", (double) result->cycles / CPU_CLOCK_SPEED);
+        fprintf(file, ", \"seconds\": %.3f", result->seconds);
+        fprintf(file, ", \"serial\": ");
+        runner_json_string(file, (const char *) result->serial, result->serial_size);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
+
+void print_usage(const char *cmd)
+{
+    printf("Usage: %s [-h] [-l level] [-j jobs] [-t seconds] [-o file] path...\n", cmd);
+}
+
+void print_help(const char *cmd)
+{
+    print_usage(cmd);
+    printf("\nDescription:\n");
+    printf("    path            Test ROM, or directory to search for .gb/.gbc\n");
+    printf("                    test ROMs\n\n");
+    printf("    -h              Show this help message\n");
+    printf("    -l level        Set logging to level (default: crit)\n");
+    printf("                    Options: crit, error, warn, info, debug, all\n");
+    printf("    -j jobs         Number of ROMs to run at once (default: number of\n");
+    printf("                    CPUs)\n");
+    printf("    -t seconds      Emulated time after which a ROM times out\n");
+    printf("                    (default: %.0f)\n", RUNNER_DEFAULT_SECONDS);
+    printf("    -o file         Write the JSON report to file (default: standard\n");
+    printf("                    output)\n\n");
+    printf("A ROM passes or fails when it prints Passed or Failed over the serial\n");
+    printf("port, or when it executes LD B,B with the Mooneye registers signature.\n");
+    printf("Exits with 0 if all the ROMs passed, 1 otherwise.\n");
+}
+
+int main(int ac, char **av)
+{
+    const char shortopts[] = "hl:j:t:o:";
+    struct runner runner = {0};
+    const char *output = NULL;
+    double seconds = RUNNER_DEFAULT_SECONDS;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *threads;
+    double start;
+    FILE *file;
+    char *endptr;
+    bool all_passed = true;
+    int opt;
+
+    logger_set_level_name("crit");
+    while ((opt = getopt(ac, av, shortopts)) >= 0) {
+        switch (opt) {
+            case 'h':
+                print_help(av[0]);
+                return EXIT_SUCCESS;
+
+            case 'l':
+                if (!logger_set_level_name(optarg)) {
+                    fprintf(stderr, "Invalid log level: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'j':
+                if ((jobs = strtol(optarg, &endptr, 10)) <= 0 || *endptr) {
+                    fprintf(stderr, "Invalid number of jobs: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 't':
+                if ((seconds = strtod(optarg, &endptr)) <= 0.0 || *endptr) {
+                    fprintf(stderr, "Invalid timeout: '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default: return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= ac) {
+        print_usage(av[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = optind; i < ac; ++i) {
+        if (!runner_scan(&runner, av[i]))
+            return EXIT_FAILURE;
+    }
+    if (runner.count == 0) {
+        fprintf(stderr, "No test ROMs found\n");
+        return EXIT_FAILURE;
+    }
+    qsort(runner.results, runner.count, sizeof(struct runner_result), &runner_compare);
+    runner.max_cycles = (size_t) (seconds * CPU_CLOCK_SPEED);
+    if ((size_t) jobs > runner.count)
+        jobs = runner.count;
+
+    start = runner_now();
+    threads = xalloc(sizeof(pthread_t) * jobs);
+    for (long i = 0; i < jobs; ++i) {
+        if (pthread_create(&threads[i], NULL, &runner_thread, &runner)) {
+            fprintf(stderr, "Failed to create thread %li\n", i);
+            jobs = i;
+            break;
+        }
+    }
+    if (jobs == 0) {
+        free(threads);
+        return EXIT_FAILURE;
+    }
+    for (long i = 0; i < jobs; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (!output) {
+        file = stdout;
+    } else if (!(file = fopen(output, "w"))) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    runner_write_json(file, &runner, (int) jobs, runner_now() - start);
+    if (file != stdout)
+        fclose(file);
+
+    for (size_t i = 0; i < runner.count; ++i) {
+        if (runner.results[i].status != RUNNER_PASS)
+            all_passed = false;
+        free(runner.results[i].rom);
+    }
+    free(runner.results);
+    return all_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -18,183 +18,490 @@ You should have received a copy of the GNU General Public License along with
 this program. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "xalloc.h"
 #include "apu/apu.h"
+#include "apu/blip.h"
+
+// Duty cycle waveforms of the Tone channels (1 == high)
+static const byte_t duty_waveforms[4][8] = {
+    {0, 0, 0, 0, 0, 0, 0, 1}, // 12.5%
+    {1, 0, 0, 0, 0, 0, 0, 1}, // 25%
+    {1, 0, 0, 0, 0, 1, 1, 1}, // 50%
+    {0, 1, 1, 1, 1, 1, 1, 0}  // 75%
+};
+
+// Output level of a Tone channel
+static inline float tone_level(const byte_t duty, const byte_t duty_pos, const byte_t volume)
+{
+    return duty_waveforms[duty][duty_pos] ? apu_volume_percent(volume) : -apu_volume_percent(volume);
+}
 
-static double ch1_sample(const double atime, gb_system_t *gb)
+// Output level of the Wave channel
+static inline float wave_level(gb_system_t *gb)
 {
-    if (gb->apu.regs.nr14.initial) {
-        gb->apu.regs.nr14.initial = 0;
-        gb->apu.regs.nr52.ch1_on = 1;
-        gb->apu.ch1.stop_at = atime + gb->apu.ch1.length;
-        gb->apu.ch1.next_volume_step = atime + gb->apu.ch1.volume_step;
-        gb->apu.ch1.next_sweep = atime + gb->apu.ch1.sweep;
-        gb->apu.ch1.freq11 = apu_freq11(gb->apu.regs.nr13, gb->apu.regs.nr14);
-    }
-    if (!gb->apu.regs.nr52.ch1_on || (gb->apu.regs.nr14.counter_select && atime >= gb->apu.ch1.stop_at)) {
-        gb->apu.regs.nr52.ch1_on = 0;
-        return 0.0;
-    }
+    byte_t sample_out = 0;
 
-    if (gb->apu.ch1.sweep > 0.0 && atime >= gb->apu.ch1.next_sweep) {
-        if (gb->apu.regs.nr10.sweep_decrease) {
-            gb->apu.ch1.freq11 -= (gb->apu.ch1.freq11 >> gb->apu.regs.nr10.sweep_shift);
-        } else {
-            gb->apu.ch1.freq11 += (gb->apu.ch1.freq11 >> gb->apu.regs.nr10.sweep_shift);
-        }
+    if (gb->apu.regs.nr32.output_level > 0)
+        sample_out = (gb->apu.ch3.wave_sample >> (gb->apu.regs.nr32.output_level - 1));
+    return apu_wave_audio_sample(sample_out);
+}
 
-        if (gb->apu.ch1.freq11 > 2047) {
-            gb->apu.regs.nr52.ch1_on = 0;
-            return 0.0;
-        }
+// LFSR register contents for each phase of the 15-bit and 7-bit sequences
+// The 7-bit states are taken once the upper bits only hold the XOR history
+static uint16_t lfsr15_states[APU_LFSR15_PERIOD + 1];
+static uint16_t lfsr7_states[APU_LFSR7_PERIOD + 1];
 
-        gb->apu.regs.nr13.freq_lo = (gb->apu.ch1.freq11 & 0xFF);
-        gb->apu.regs.nr14.freq_hi = ((gb->apu.ch1.freq11 >> 8) & 0x7);
-        gb->apu.ch1.freq = apu_tone_freq(gb->apu.ch1.freq11);
-        gb->apu.ch1.next_sweep = atime + gb->apu.ch1.sweep;
-    }
+// Returns the LFSR register contents at the current phase
+static inline uint16_t apu_lfsr(gb_system_t *gb)
+{
+    if (gb->apu.ch4.lfsr_width7)
+        return lfsr7_states[gb->apu.ch4.lfsr_phase];
+    return lfsr15_states[gb->apu.ch4.lfsr_phase];
+}
+
+// Output level of the Noise channel
+static inline float noise_level(gb_system_t *gb)
+{
+    return (apu_lfsr(gb) & 0x1) ? 0.0f : apu_volume_percent(gb->apu.ch4.volume);
+}
 
-    if (gb->apu.ch1.volume_step && atime >= gb->apu.ch1.next_volume_step) {
-        apu_volume_envelope(gb->apu.ch1.volume, gb->apu.regs.nr12.envelope_increase)
-        gb->apu.ch1.next_volume_step = atime + gb->apu.ch1.volume_step;
+// Change a channel's output level elapsed clocks after blip_time, the step
+// is added to the band-limited buffer (and to the channel's stem)
+static inline void apu_output(const int channel,
+                              float *out,
+                              const float level,
+                              const uint32_t elapsed,
+                              const float gain,
+                              gb_system_t *gb)
+{
+    float delta = gain * (level - *out);
+
+    *out = level;
+    if (delta != 0.0f) {
+        blip_add_delta(&gb->apu.blip, gb->apu.blip_time + elapsed, delta);
+        gb->apu.amp += delta;
+
+        if (gb->apu.stems) {
+            blip_add_delta(&gb->apu.stems->blip[channel], gb->apu.blip_time + elapsed, delta);
+            gb->apu.stems->amp[channel] += delta;
+        }
     }
+}
+
+// Shift the LFSR once, the XOR of bits 1-0 goes to bit 14 (and bit 6 when
+// the counter width is 7 bits)
+static uint16_t apu_lfsr_shift(uint16_t lfsr, const bool width7)
+{
+    const uint16_t lfsr_xor = (lfsr ^ (lfsr >> 1)) & 0x1;
 
-    return apu_volume_percent(gb->apu.ch1.volume) * pulse_sample(atime, gb->apu.ch1.freq, gb->apu.ch1.duty);
+    lfsr = (lfsr >> 1) | (lfsr_xor << 14);
+    if (width7)
+        lfsr = (lfsr & ~(1 << 6)) | (lfsr_xor << 6);
+    return lfsr;
 }
 
-static double ch2_sample(const double atime, gb_system_t *gb)
+// Precompute the LFSR sequences, phase 0 is the state after a trigger
+static void apu_lfsr_initialize(void)
 {
-    if (gb->apu.regs.nr24.initial) {
-        gb->apu.regs.nr24.initial = 0;
-        gb->apu.regs.nr52.ch2_on = 1;
-        gb->apu.ch2.stop_at = atime + gb->apu.ch2.length;
-        gb->apu.ch2.next_volume_step = atime + gb->apu.ch2.volume_step;
+    uint16_t lfsr = 0x7FFF;
+
+    for (int i = 0; i < APU_LFSR15_PERIOD; ++i) {
+        lfsr15_states[i] = lfsr;
+        lfsr = apu_lfsr_shift(lfsr, false);
     }
-    if (!gb->apu.regs.nr52.ch2_on || (gb->apu.regs.nr24.counter_select && atime >= gb->apu.ch2.stop_at)) {
-        gb->apu.regs.nr52.ch2_on = 0;
-        return 0.0;
+    lfsr15_states[APU_LFSR15_PERIOD] = 0;
+
+    // Run a full period so that bits 14-7 are filled with the XOR history,
+    // the lower 7 bits are back to 0x7F
+    lfsr = 0x7FFF;
+    for (int i = 0; i < APU_LFSR7_PERIOD; ++i)
+        lfsr = apu_lfsr_shift(lfsr, true);
+    for (int i = 0; i < APU_LFSR7_PERIOD; ++i) {
+        lfsr7_states[i] = lfsr;
+        lfsr = apu_lfsr_shift(lfsr, true);
     }
+    lfsr7_states[APU_LFSR7_PERIOD] = 0;
+}
 
-    if (gb->apu.ch2.volume_step && atime >= gb->apu.ch2.next_volume_step) {
-        apu_volume_envelope(gb->apu.ch2.volume, gb->apu.regs.nr22.envelope_increase)
-        gb->apu.ch2.next_volume_step = atime + gb->apu.ch2.volume_step;
-    }
+// Advance the LFSR by count shifts
+static inline void apu_lfsr_advance(const uint32_t count, gb_system_t *gb)
+{
+    const uint32_t period = apu_lfsr_period(gb->apu.ch4.lfsr_width7);
 
-    return apu_volume_percent(gb->apu.ch2.volume) * pulse_sample(atime, gb->apu.ch2.freq, gb->apu.ch2.duty);
+    // The all-zero state never changes
+    if (gb->apu.ch4.lfsr_phase != period)
+        gb->apu.ch4.lfsr_phase = (gb->apu.ch4.lfsr_phase + count) % period;
 }
 
-static double ch3_sample(const double atime, gb_system_t *gb)
+// Move the phase to the sequence of the counter width selected in NR43,
+// keeping the current LFSR register contents
+void apu_lfsr_set_width(gb_system_t *gb)
 {
-    if (gb->apu.regs.nr34.initial) {
-        gb->apu.regs.nr34.initial = 0;
-        gb->apu.regs.nr52.ch3_on = 1;
-        gb->apu.ch3.stop_at = atime + gb->apu.ch3.length;
-        gb->apu.ch3.wave_index = 0;
-        gb->apu.ch3.time_elapsed = 0;
+    const bool width7 = gb->apu.regs.nr43.counter_width;
+    uint16_t lfsr = apu_lfsr(gb);
+    uint32_t phase;
+
+    if (width7 == gb->apu.ch4.lfsr_width7)
+        return;
+
+    // The sequences are only generated with the audio output
+    if (!gb->apu.output) {
+        gb->apu.ch4.lfsr_width7 = width7;
+        gb->apu.ch4.lfsr_phase = 0;
+        return;
+    }
+
+    // The 7-bit counter only depends on the lower 7 bits, the 15-bit
+    // counter on the whole register
+    phase = 0;
+    if (width7) {
+        lfsr &= 0x7F;
+        while (phase < APU_LFSR7_PERIOD && (lfsr7_states[phase] & 0x7F) != lfsr)
+            phase += 1;
+    } else {
+        while (phase < APU_LFSR15_PERIOD && lfsr15_states[phase] != lfsr)
+            phase += 1;
     }
+    gb->apu.ch4.lfsr_width7 = width7;
+    gb->apu.ch4.lfsr_phase = phase;
+}
 
-    if (!gb->apu.regs.nr30.active || !gb->apu.regs.nr52.ch3_on || (gb->apu.regs.nr34.counter_select && atime >= gb->apu.ch3.stop_at)) {
-        gb->apu.regs.nr52.ch3_on = 0;
-        return 0.0;
+// Trigger event (bit 7 of NRx4 written), channel is 1 to 4
+void apu_trigger(const byte_t channel, gb_system_t *gb)
+{
+    switch (channel) {
+        case 1:
+            gb->apu.regs.nr14.initial = 0;
+            gb->apu.regs.nr52.ch1_on = 1;
+            if (gb->apu.ch1.length == 0)
+                gb->apu.ch1.length = apu_sound_length(0);
+            gb->apu.ch1.volume = gb->apu.regs.nr12.initial_envelope_volume;
+            gb->apu.ch1.envelope_timer = gb->apu.regs.nr12.envelope_sweep;
+            gb->apu.ch1.freq11 = apu_freq11(gb->apu.regs.nr13, gb->apu.regs.nr14);
+            gb->apu.ch1.sweep_timer = gb->apu.regs.nr10.sweep_time;
+            gb->apu.ch1.timer = apu_tone_period(gb->apu.ch1.freq11);
+            break;
+
+        case 2:
+            gb->apu.regs.nr24.initial = 0;
+            gb->apu.regs.nr52.ch2_on = 1;
+            if (gb->apu.ch2.length == 0)
+                gb->apu.ch2.length = apu_sound_length(0);
+            gb->apu.ch2.volume = gb->apu.regs.nr22.initial_envelope_volume;
+            gb->apu.ch2.envelope_timer = gb->apu.regs.nr22.envelope_sweep;
+            gb->apu.ch2.timer = apu_tone_period(apu_freq11(gb->apu.regs.nr23, gb->apu.regs.nr24));
+            break;
+
+        case 3:
+            gb->apu.regs.nr34.initial = 0;
+            gb->apu.regs.nr52.ch3_on = gb->apu.regs.nr30.active;
+            if (gb->apu.ch3.length == 0)
+                gb->apu.ch3.length = apu_wave_sound_length(0);
+            gb->apu.ch3.wave_index = 0;
+            gb->apu.ch3.timer = apu_wave_period(apu_freq11(gb->apu.regs.nr33, gb->apu.regs.nr34));
+            break;
+
+        case 4:
+            gb->apu.regs.nr44.initial = 0;
+            gb->apu.regs.nr52.ch4_on = 1;
+            if (gb->apu.ch4.length == 0)
+                gb->apu.ch4.length = apu_sound_length(0);
+            gb->apu.ch4.volume = gb->apu.regs.nr42.initial_envelope_volume;
+            gb->apu.ch4.envelope_timer = gb->apu.regs.nr42.envelope_sweep;
+            gb->apu.ch4.timer = apu_noise_period(gb->apu.regs.nr43.dividing_ratio,
+                                                 gb->apu.regs.nr43.shift_clock_freq);
+            gb->apu.ch4.lfsr_width7 = gb->apu.regs.nr43.counter_width;
+            gb->apu.ch4.lfsr_phase = 0;
+            break;
+
+        default: break;
     }
+}
 
-    if (gb->apu.ch3.wave_sample_duration <= 0.0)
-        return 0.0;
+// Clock a length counter, the channel stops when it reaches 0
+#define apu_length_clock(ch, nrx4, on) \
+    if (nrx4.counter_select && ch.length > 0 && --ch.length == 0) { on = 0; }
 
-    gb->apu.ch3.time_elapsed += gb->apu.sample_duration;
-    while (gb->apu.ch3.time_elapsed >= gb->apu.ch3.wave_sample_duration) {
-        ch3_select_next_sample(gb);
-        gb->apu.ch3.time_elapsed -= gb->apu.ch3.wave_sample_duration;
+// Clock a volume envelope
+#define apu_envelope_clock(ch, nrx2) \
+    if (nrx2.envelope_sweep && (ch.envelope_timer == 0 || --ch.envelope_timer == 0)) { \
+        ch.envelope_timer = nrx2.envelope_sweep;                                        \
+        apu_volume_envelope(ch.volume, nrx2.envelope_increase)                          \
     }
 
-    if (gb->apu.regs.nr32.output_level > 0) {
-        gb->apu.ch3.sample_out = (gb->apu.ch3.wave_sample >> (gb->apu.regs.nr32.output_level - 1));
+// Clock channel 1's frequency sweep
+static void apu_sweep_clock(gb_system_t *gb)
+{
+    if (!gb->apu.regs.nr10.sweep_time)
+        return;
+    if (gb->apu.ch1.sweep_timer > 0 && --gb->apu.ch1.sweep_timer > 0)
+        return;
+
+    gb->apu.ch1.sweep_timer = gb->apu.regs.nr10.sweep_time;
+    if (gb->apu.regs.nr10.sweep_decrease) {
+        gb->apu.ch1.freq11 -= (gb->apu.ch1.freq11 >> gb->apu.regs.nr10.sweep_shift);
     } else {
-        gb->apu.ch3.sample_out = 0;
+        gb->apu.ch1.freq11 += (gb->apu.ch1.freq11 >> gb->apu.regs.nr10.sweep_shift);
+    }
+
+    if (gb->apu.ch1.freq11 > 2047) {
+        gb->apu.regs.nr52.ch1_on = 0;
+        return;
     }
 
-    return apu_wave_audio_sample(gb->apu.ch3.sample_out);
+    gb->apu.regs.nr13.freq_lo = (gb->apu.ch1.freq11 & 0xFF);
+    gb->apu.regs.nr14.freq_hi = ((gb->apu.ch1.freq11 >> 8) & 0x7);
 }
 
-static double ch4_sample(const double atime, gb_system_t *gb)
+// Frame sequencer step (512 Hz)
+static void apu_frame_sequencer(gb_system_t *gb)
 {
-    if (gb->apu.regs.nr44.initial) {
-        gb->apu.regs.nr44.initial = 0;
-        gb->apu.regs.nr52.ch4_on = 1;
-        gb->apu.ch4.stop_at = atime + gb->apu.ch4.length;
-        gb->apu.ch4.next_volume_step = atime + gb->apu.ch4.volume_step;
-    }
-    if (!gb->apu.regs.nr52.ch4_on || (gb->apu.regs.nr44.counter_select && atime >= gb->apu.ch4.stop_at)) {
-        gb->apu.regs.nr52.ch4_on = 0;
-        return 0.0;
+    if ((gb->apu.fs_step % 2) == 0) {
+        apu_length_clock(gb->apu.ch1, gb->apu.regs.nr14, gb->apu.regs.nr52.ch1_on)
+        apu_length_clock(gb->apu.ch2, gb->apu.regs.nr24, gb->apu.regs.nr52.ch2_on)
+        apu_length_clock(gb->apu.ch3, gb->apu.regs.nr34, gb->apu.regs.nr52.ch3_on)
+        apu_length_clock(gb->apu.ch4, gb->apu.regs.nr44, gb->apu.regs.nr52.ch4_on)
     }
 
-    if (gb->apu.ch4.volume_step && atime >= gb->apu.ch4.next_volume_step) {
-        apu_volume_envelope(gb->apu.ch4.volume, gb->apu.regs.nr42.envelope_increase)
-        gb->apu.ch4.next_volume_step = atime + gb->apu.ch4.volume_step;
+    if (gb->apu.fs_step == 2 || gb->apu.fs_step == 6) {
+        if (gb->apu.regs.nr52.ch1_on)
+            apu_sweep_clock(gb);
     }
 
-    if ((gb->apu.lfsr & 0x1))
-        return 0.0;
+    // The volume is not visible to the guest, it only matters with the
+    // audio output
+    if (gb->apu.fs_step == 7 && gb->apu.output) {
+        apu_envelope_clock(gb->apu.ch1, gb->apu.regs.nr12)
+        apu_envelope_clock(gb->apu.ch2, gb->apu.regs.nr22)
+        apu_envelope_clock(gb->apu.ch4, gb->apu.regs.nr42)
+    }
 
-    return apu_volume_percent(gb->apu.ch4.volume);
+    gb->apu.fs_step = (gb->apu.fs_step + 1) & 0x7;
 }
 
-void apu_lfsr_clock(gb_system_t *gb)
+// Run the frequency timers for clocks
+// The output level of a channel only changes when its timer expires
+static void apu_run_timers(const uint32_t clocks, gb_system_t *gb)
 {
-    byte_t lfsr_xor;
+    uint32_t elapsed, period, count;
+
+    elapsed = 0;
+    while (gb->apu.ch1.timer < clocks - elapsed) {
+        elapsed += gb->apu.ch1.timer;
+        gb->apu.ch1.timer = apu_tone_period(apu_freq11(gb->apu.regs.nr13, gb->apu.regs.nr14));
+        gb->apu.ch1.duty_pos = (gb->apu.ch1.duty_pos + 1) & 0x7;
+        apu_output(0, &gb->apu.ch1.out,
+                   tone_level(gb->apu.regs.nr11.wave_duty, gb->apu.ch1.duty_pos, gb->apu.ch1.volume),
+                   elapsed, gb->apu.gains[0], gb);
+    }
+    gb->apu.ch1.timer -= clocks - elapsed;
+
+    elapsed = 0;
+    while (gb->apu.ch2.timer < clocks - elapsed) {
+        elapsed += gb->apu.ch2.timer;
+        gb->apu.ch2.timer = apu_tone_period(apu_freq11(gb->apu.regs.nr23, gb->apu.regs.nr24));
+        gb->apu.ch2.duty_pos = (gb->apu.ch2.duty_pos + 1) & 0x7;
+        apu_output(1, &gb->apu.ch2.out,
+                   tone_level(gb->apu.regs.nr21.wave_duty, gb->apu.ch2.duty_pos, gb->apu.ch2.volume),
+                   elapsed, gb->apu.gains[1], gb);
+    }
+    gb->apu.ch2.timer -= clocks - elapsed;
 
-    // XOR bits 1-0 and shift lfsr to the right
-    lfsr_xor = (gb->apu.lfsr & 0x1);
-    gb->apu.lfsr >>= 1;
-    lfsr_xor ^= (gb->apu.lfsr & 0x1);
+    elapsed = 0;
+    while (gb->apu.ch3.timer < clocks - elapsed) {
+        elapsed += gb->apu.ch3.timer;
+        gb->apu.ch3.timer = apu_wave_period(apu_freq11(gb->apu.regs.nr33, gb->apu.regs.nr34));
+        ch3_select_next_sample(gb);
+        apu_output(2, &gb->apu.ch3.out, wave_level(gb), elapsed, gb->apu.gains[2], gb);
+    }
+    gb->apu.ch3.timer -= clocks - elapsed;
+
+    period = apu_noise_period(gb->apu.regs.nr43.dividing_ratio,
+                              gb->apu.regs.nr43.shift_clock_freq);
+    if (gb->apu.gains[3] == 0.0f || gb->apu.ch4.volume == 0) {
+        // The noise is silent, only its phase has to be kept
+        if (gb->apu.ch4.timer < clocks) {
+            count = (clocks - gb->apu.ch4.timer - 1) / period + 1;
+            apu_lfsr_advance(count, gb);
+            gb->apu.ch4.timer += count * period;
+        }
+        gb->apu.ch4.timer -= clocks;
+        gb->apu.ch4.out = noise_level(gb);
+    } else {
+        elapsed = 0;
+        while (gb->apu.ch4.timer < clocks - elapsed) {
+            elapsed += gb->apu.ch4.timer;
+            gb->apu.ch4.timer = period;
+            apu_lfsr_advance(1, gb);
+            apu_output(3, &gb->apu.ch4.out, noise_level(gb), elapsed, gb->apu.gains[3], gb);
+        }
+        gb->apu.ch4.timer -= clocks - elapsed;
+    }
+}
 
-    // Put XOR result on bit 15
-    gb->apu.lfsr |= (lfsr_xor << 14);
-    if (gb->apu.regs.nr43.counter_width) {
-        // Put XOR result on bit 7 when counter_width is set to 7 bits
-        gb->apu.lfsr &= ~(1 << 6);
-        gb->apu.lfsr |= (lfsr_xor << 6);
+// Returns the mixing gain of a channel
+static inline float apu_channel_gain(const bool on, const bool to_so1, const bool to_so2, gb_system_t *gb)
+{
+    if (!on || !gb->apu.regs.nr52.sound_on) {
+        return 0.0f;
+    } else if (to_so1) {
+        return apu_so_volume_percent(gb->apu.regs.nr50.so1_volume) / 4.0;
+    } else if (to_so2) {
+        return apu_so_volume_percent(gb->apu.regs.nr50.so2_volume) / 4.0;
     }
+    return 0.0f;
 }
 
-double apu_generate_sample(const double atime, gb_system_t *gb)
+// Update the mixing gains and output levels after a register write or a
+// frame sequencer step, the change happens at the current position
+void apu_update_mix(gb_system_t *gb)
 {
-    double sample = 0.0;
-    const double so1_volume = apu_so_volume_percent(gb->apu.regs.nr50.so1_volume);
-    const double so2_volume = apu_so_volume_percent(gb->apu.regs.nr50.so2_volume);
+    float amp;
+
+    if (!gb->apu.output)
+        return;
+
+    gb->apu.gains[0] = apu_channel_gain(gb->apu.regs.nr52.ch1_on,
+        gb->apu.regs.nr51.ch1_to_so1, gb->apu.regs.nr51.ch1_to_so2, gb);
+    gb->apu.gains[1] = apu_channel_gain(gb->apu.regs.nr52.ch2_on,
+        gb->apu.regs.nr51.ch2_to_so1, gb->apu.regs.nr51.ch2_to_so2, gb);
+    gb->apu.gains[2] = apu_channel_gain(gb->apu.regs.nr52.ch3_on,
+        gb->apu.regs.nr51.ch3_to_so1, gb->apu.regs.nr51.ch3_to_so2, gb);
+    gb->apu.gains[3] = apu_channel_gain(gb->apu.regs.nr52.ch4_on,
+        gb->apu.regs.nr51.ch4_to_so1, gb->apu.regs.nr51.ch4_to_so2, gb);
+
+    gb->apu.ch1.out = tone_level(gb->apu.regs.nr11.wave_duty, gb->apu.ch1.duty_pos, gb->apu.ch1.volume);
+    gb->apu.ch2.out = tone_level(gb->apu.regs.nr21.wave_duty, gb->apu.ch2.duty_pos, gb->apu.ch2.volume);
+    gb->apu.ch3.out = wave_level(gb);
+    gb->apu.ch4.out = noise_level(gb);
+
+    amp =   (gb->apu.gains[0] * gb->apu.ch1.out)
+          + (gb->apu.gains[1] * gb->apu.ch2.out)
+          + (gb->apu.gains[2] * gb->apu.ch3.out)
+          + (gb->apu.gains[3] * gb->apu.ch4.out);
+    if (amp != gb->apu.amp) {
+        blip_add_delta(&gb->apu.blip, gb->apu.blip_time, amp - gb->apu.amp);
+        gb->apu.amp = amp;
+    }
 
-    if (!gb->apu.regs.nr52.sound_on)
-        return 0.0;
+    if (gb->apu.stems) {
+        const float outs[4] = {gb->apu.ch1.out, gb->apu.ch2.out, gb->apu.ch3.out, gb->apu.ch4.out};
 
-    if (gb->apu.regs.nr51.ch1_to_so1) {
-        sample += so1_volume * ch1_sample(atime, gb);
-    } else if (gb->apu.regs.nr51.ch1_to_so2) {
-        sample += so2_volume * ch1_sample(atime, gb);
+        for (int i = 0; i < 4; ++i) {
+            amp = gb->apu.gains[i] * outs[i];
+            if (amp != gb->apu.stems->amp[i]) {
+                blip_add_delta(&gb->apu.stems->blip[i], gb->apu.blip_time, amp - gb->apu.stems->amp[i]);
+                gb->apu.stems->amp[i] = amp;
+            }
+        }
     }
+}
 
-    if (gb->apu.regs.nr51.ch2_to_so1) {
-        sample += so1_volume * ch2_sample(atime, gb);
-    } else if (gb->apu.regs.nr51.ch2_to_so2) {
-        sample += so2_volume * ch2_sample(atime, gb);
-    }
+// Move the completed samples from the blip buffer to gb->apu.samples
+static void apu_read_samples(gb_system_t *gb)
+{
+    uint32_t count = gb->apu.blip_time / APU_NATIVE_CLOCKS;
 
-    if (gb->apu.regs.nr51.ch3_to_so1) {
-        sample += so1_volume * ch3_sample(atime, gb);
-    } else if (gb->apu.regs.nr51.ch3_to_so2) {
-        sample += so2_volume * ch3_sample(atime, gb);
+    blip_read_samples(&gb->apu.blip, &gb->apu.samples[gb->apu.samples_count], count);
+    if (gb->apu.stems) {
+        for (int i = 0; i < 4; ++i)
+            blip_read_samples(&gb->apu.stems->blip[i], &gb->apu.stems->samples[i][gb->apu.samples_count], count);
     }
+    gb->apu.samples_count += count;
+    gb->apu.blip_time %= APU_NATIVE_CLOCKS;
+}
 
-    if (gb->apu.regs.nr51.ch4_to_so1) {
-        sample += so1_volume * ch4_sample(atime, gb);
-    } else if (gb->apu.regs.nr51.ch4_to_so2) {
-        sample += so2_volume * ch4_sample(atime, gb);
+// Returns true if a frame sequencer step can change the guest-visible
+// state (NR52 channel status) without the audio output
+static inline bool apu_fs_visible(gb_system_t *gb)
+{
+    return (gb->apu.regs.nr14.counter_select && gb->apu.ch1.length > 0)
+        || (gb->apu.regs.nr24.counter_select && gb->apu.ch2.length > 0)
+        || (gb->apu.regs.nr34.counter_select && gb->apu.ch3.length > 0)
+        || (gb->apu.regs.nr44.counter_select && gb->apu.ch4.length > 0)
+        || (gb->apu.regs.nr52.ch1_on && gb->apu.regs.nr10.sweep_time);
+}
+
+// Skip the frame sequencer steps of clocks without running them
+static void apu_fs_skip(const size_t clocks, gb_system_t *gb)
+{
+    size_t count = 0;
+
+    // Like apu_sync(), a step that falls on the last clock stays pending
+    if (gb->apu.fs_timer < clocks)
+        count = (clocks - gb->apu.fs_timer - 1) / APU_FRAME_SEQUENCER_CLOCKS + 1;
+    gb->apu.fs_step = (gb->apu.fs_step + count) & 0x7;
+    gb->apu.fs_timer = gb->apu.fs_timer + (count * APU_FRAME_SEQUENCER_CLOCKS) - clocks;
+}
+
+// Emulate the APU up to the current cycle
+// Without the audio output (lazy mode) only the length counters and the
+// sweep are clocked, they are the only state visible to the guest, and
+// frame sequencer steps that cannot change them are skipped at once
+void apu_sync(gb_system_t *gb)
+{
+    size_t clocks = gb->cycle_nb - gb->apu.cycle;
+    uint32_t n, space;
+
+    gb->apu.cycle = gb->cycle_nb;
+    while (clocks > 0) {
+        if (gb->apu.fs_timer == 0) {
+            gb->apu.fs_timer = APU_FRAME_SEQUENCER_CLOCKS;
+            apu_frame_sequencer(gb);
+            apu_update_mix(gb);
+        }
+
+        if (!gb->apu.output && !apu_fs_visible(gb)) {
+            apu_fs_skip(clocks, gb);
+            return;
+        }
+
+        // Run until the next frame sequencer step
+        n = (clocks < gb->apu.fs_timer) ? clocks : gb->apu.fs_timer;
+        if (gb->apu.output) {
+            // The samples were not read in time, the APU falls behind until
+            // they are (the unread samples are kept)
+            space = ((APU_SAMPLES_SIZE - gb->apu.samples_count) * APU_NATIVE_CLOCKS) - gb->apu.blip_time;
+            if (space == 0) {
+                gb->apu.cycle -= clocks;
+                return;
+            }
+            if (n > space)
+                n = space;
+
+            apu_run_timers(n, gb);
+            gb->apu.blip_time += n;
+            apu_read_samples(gb);
+        }
+
+        gb->apu.fs_timer -= n;
+        clocks -= n;
     }
+}
 
-    return sample / 4.0;
+// Render each channel separately in gb->apu.stems in addition to the mix
+// Must be called after apu_initialize()
+void apu_enable_stems(gb_system_t *gb)
+{
+    if (gb->apu.stems)
+        return;
+
+    apu_sync(gb);
+    // The stems start silent at the current position, samples that were
+    // not read yet are silent in the stems
+    gb->apu.stems = xzalloc(sizeof(struct apu_stems));
+    apu_update_mix(gb);
 }
 
-void apu_initialize(const uint32_t sample_rate, gb_system_t *gb)
+// Enable the audio output, blocks of samples at APU_NATIVE_RATE are stored
+// in gb->apu.samples when the APU is synchronized
+void apu_initialize(gb_system_t *gb)
 {
-    gb->apu.sample_rate = sample_rate;
-    gb->apu.sample_duration = 1.0 / (double) sample_rate;
-}
\ No newline at end of file
+    blip_initialize();
+    apu_lfsr_initialize();
+    apu_sync(gb);
+    gb->apu.output = true;
+    gb->apu.blip_time = 0;
+    gb->apu.samples_count = 0;
+    apu_update_mix(gb);
+}
@@ -0,0 +1,82 @@
+/*
+blip.c
+Band-limited step synthesis
+
+The channels' output levels only change on their timer edges, each change
+is added to the buffer as a band-limited step (a windowed sinc impulse
+which is integrated when reading samples) instead of a hard step, so that
+square waves do not alias at any host sample rate
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "apu/blip.h"
+#include <math.h>
+#include <string.h>
+
+// Impulses for each sub-sample phase, each one sums to 1
+float blip_kernel[BLIP_PHASES][BLIP_TAPS];
+
+// Leak of the integrator, removes the DC offset like the DMG output
+// capacitor does (about 4 Hz at APU_NATIVE_RATE)
+#define BLIP_LEAK (0.9998f)
+
+// Cutoff frequency relative to the sample rate
+#define BLIP_CUTOFF (0.45)
+
+// Compute the impulses (only once)
+void blip_initialize(void)
+{
+    static bool initialized = false;
+    const double pi = 3.14159265358979323846;
+
+    if (initialized)
+        return;
+
+    for (int p = 0; p < BLIP_PHASES; ++p) {
+        double sum = 0.0;
+
+        for (int i = 0; i < BLIP_TAPS; ++i) {
+            // Distance to the center of the kernel (delayed by BLIP_TAPS / 2)
+            double x = (double) i - (BLIP_TAPS / 2) - ((double) p / BLIP_PHASES);
+            double sinc = (x == 0.0) ? 1.0 : sin(2.0 * pi * BLIP_CUTOFF * x) / (2.0 * pi * BLIP_CUTOFF * x);
+            double window = 0.42 + 0.5 * cos(pi * x / (BLIP_TAPS / 2)) + 0.08 * cos(2.0 * pi * x / (BLIP_TAPS / 2));
+
+            if (fabs(x) >= (BLIP_TAPS / 2))
+                window = 0.0;
+            blip_kernel[p][i] = sinc * window;
+            sum += blip_kernel[p][i];
+        }
+        for (int i = 0; i < BLIP_TAPS; ++i)
+            blip_kernel[p][i] /= sum;
+    }
+    initialized = true;
+}
+
+// Integrate count samples to *out and remove them from the buffer
+void blip_read_samples(struct blip_buffer *blip, float *out, const uint32_t count)
+{
+    float sum = blip->sum;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        sum = (sum * BLIP_LEAK) + blip->deltas[i];
+        out[i] = sum;
+    }
+    blip->sum = sum;
+
+    // Keep the tails of the impulses
+    memmove(blip->deltas, &blip->deltas[count], BLIP_TAPS * sizeof(float));
+    memset(&blip->deltas[BLIP_TAPS], 0, count * sizeof(float));
+}
@@ -0,0 +1,118 @@
+/*
+resampler.c
+Polyphase windowed-sinc resampler
+
+Converts blocks of samples from the APU's native rate to the output rate,
+each output sample is the dot product of RESAMPLER_TAPS input samples with
+the filter phase closest to its position
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "apu/resampler.h"
+#include <math.h>
+#include <string.h>
+
+// Initialize *rs to convert from in_rate to out_rate Hz
+void resampler_init(resampler_t *rs, const uint32_t in_rate, const uint32_t out_rate)
+{
+    const double pi = 3.14159265358979323846;
+
+    // Low-pass below the Nyquist frequency of the lowest rate
+    const double cutoff = 0.45 * ((out_rate < in_rate) ? (double) out_rate / (double) in_rate : 1.0);
+
+    for (int p = 0; p < RESAMPLER_PHASES; ++p) {
+        double sum = 0.0;
+
+        for (int i = 0; i < RESAMPLER_TAPS; ++i) {
+            double x = (double) i - (RESAMPLER_TAPS / 2 - 1) - ((double) p / RESAMPLER_PHASES);
+            double sinc = (x == 0.0) ? 1.0 : sin(2.0 * pi * cutoff * x) / (2.0 * pi * cutoff * x);
+            double w = (x + (RESAMPLER_TAPS / 2)) / RESAMPLER_TAPS;
+            double window = 0.42 - 0.5 * cos(2.0 * pi * w) + 0.08 * cos(4.0 * pi * w);
+
+            rs->kernel[p][i] = sinc * window;
+            sum += rs->kernel[p][i];
+        }
+        for (int i = 0; i < RESAMPLER_TAPS; ++i)
+            rs->kernel[p][i] /= sum;
+    }
+
+    memset(rs->input, 0, sizeof(rs->input));
+    rs->input_count = RESAMPLER_TAPS - 1;
+    rs->pos = 0;
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->step = ((uint64_t) in_rate << 32) / out_rate;
+}
+
+// Scale the nominal conversion step by ratio
+// A ratio above 1.0 consumes input faster, producing fewer output samples
+void resampler_set_ratio(resampler_t *rs, const double ratio)
+{
+    rs->step = (uint64_t) ((double) (((uint64_t) rs->in_rate << 32) / rs->out_rate) * ratio);
+}
+
+// Dot product of the input samples with a filter phase
+// The partial sums let the compiler vectorize the loop
+static inline float resampler_dot(const float *in, const float *kernel)
+{
+    float acc[8] = {0};
+
+    for (int i = 0; i < RESAMPLER_TAPS; i += 8) {
+        for (int j = 0; j < 8; ++j)
+            acc[j] += in[i + j] * kernel[i + j];
+    }
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+// Resample in_count samples from *in to *out
+// Returns the number of samples written to *out, input samples that would
+// overflow *out are dropped
+size_t resampler_process(resampler_t *rs,
+                         const float *in,
+                         size_t in_count,
+                         float *out,
+                         const size_t out_size)
+{
+    size_t out_count = 0;
+    size_t n, consumed;
+
+    while (in_count > 0) {
+        n = RESAMPLER_BUFFER_SIZE - rs->input_count;
+        if (n > in_count)
+            n = in_count;
+        memcpy(&rs->input[rs->input_count], in, n * sizeof(float));
+        rs->input_count += n;
+        in += n;
+        in_count -= n;
+
+        while ((rs->pos >> 32) + RESAMPLER_TAPS <= rs->input_count) {
+            if (out_count < out_size) {
+                out[out_count++] = resampler_dot(&rs->input[rs->pos >> 32],
+                    rs->kernel[((rs->pos & 0xFFFFFFFF) * RESAMPLER_PHASES) >> 32]);
+            }
+            rs->pos += rs->step;
+        }
+
+        // Keep the samples still needed by the filter
+        consumed = rs->pos >> 32;
+        if (consumed > rs->input_count)
+            consumed = rs->input_count;
+        memmove(rs->input, &rs->input[consumed], (rs->input_count - consumed) * sizeof(float));
+        rs->input_count -= consumed;
+        rs->pos -= (uint64_t) consumed << 32;
+    }
+    return out_count;
+}
@@ -25,6 +25,9 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 byte_t sound_reg_readb(uint16_t addr, gb_system_t *gb)
 {
+    // The channels' status in NR52 depends on the length counters
+    apu_sync(gb);
+
     switch (addr) {
         case SOUND_NR10: return (*((byte_t *) &gb->apu.regs.nr10)) | 0x80;
         case SOUND_NR11: return (*((byte_t *) &gb->apu.regs.nr11)) & 0xC0; // Bits 7 and 6 only
@@ -65,82 +68,60 @@ byte_t sound_reg_readb(uint16_t addr, gb_system_t *gb)
 }
 
 // Trigger event happens when bit 7 of any NRx4 is set
-void sound_reg_trigger_event(byte_t value, gb_system_t *gb)
+static inline void sound_reg_trigger_event(const byte_t channel, byte_t value, gb_system_t *gb)
 {
-    if ((value & 0x80)) {
-        // TODO: Add the other trigger events
-        gb->apu.lfsr = 0x7FFF;
-    }
+    if ((value & 0x80))
+        apu_trigger(channel, gb);
 }
 
-bool sound_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
+static bool sound_reg_write(uint16_t addr, byte_t value, gb_system_t *gb)
 {
     switch (addr) {
-        case SOUND_NR10:
-            (*((byte_t *) &gb->apu.regs.nr10)) = value;
-            gb->apu.ch1.sweep = (double) gb->apu.regs.nr10.sweep_time / 128.0;
-            return true;
+        case SOUND_NR10: (*((byte_t *) &gb->apu.regs.nr10)) = value; return true;
 
         case SOUND_NR11:
             (*((byte_t *) &gb->apu.regs.nr11)) = value;
-            switch (gb->apu.regs.nr11.wave_duty) {
-                case 0x0: gb->apu.ch1.duty = 0.125; break;
-                case 0x1: gb->apu.ch1.duty = 0.25;  break;
-                case 0x2: gb->apu.ch1.duty = 0.50;  break;
-                case 0x3: gb->apu.ch1.duty = 0.75;  break;
-            }
             gb->apu.ch1.length = apu_sound_length(gb->apu.regs.nr11.sound_length);
             return true;
 
         case SOUND_NR12:
             (*((byte_t *) &gb->apu.regs.nr12)) = value;
             gb->apu.ch1.volume = gb->apu.regs.nr12.initial_envelope_volume;
-            gb->apu.ch1.volume_step = apu_volume_step(gb->apu.regs.nr12.envelope_sweep);
+            gb->apu.ch1.envelope_timer = gb->apu.regs.nr12.envelope_sweep;
             return true;
 
-        case SOUND_NR13:
-            (*((byte_t *) &gb->apu.regs.nr13)) = value;
-            gb->apu.ch1.freq = apu_tone_freq(apu_freq11(gb->apu.regs.nr13, gb->apu.regs.nr14));
-            return true;
+        case SOUND_NR13: (*((byte_t *) &gb->apu.regs.nr13)) = value; return true;
 
         case SOUND_NR14:
             (*((byte_t *) &gb->apu.regs.nr14)) = value;
-            gb->apu.ch1.freq = apu_tone_freq(apu_freq11(gb->apu.regs.nr13, gb->apu.regs.nr14));
-            sound_reg_trigger_event(value, gb);
+            sound_reg_trigger_event(1, value, gb);
             return true;
 
         case SOUND_NR21:
             (*((byte_t *) &gb->apu.regs.nr21)) = value;
-            switch (gb->apu.regs.nr21.wave_duty) {
-                case 0x0: gb->apu.ch2.duty = 0.125; break;
-                case 0x1: gb->apu.ch2.duty = 0.25;  break;
-                case 0x2: gb->apu.ch2.duty = 0.50;  break;
-                case 0x3: gb->apu.ch2.duty = 0.75;  break;
-            }
             gb->apu.ch2.length = apu_sound_length(gb->apu.regs.nr21.sound_length);
             return true;
 
         case SOUND_NR22:
             (*((byte_t *) &gb->apu.regs.nr22)) = value;
             gb->apu.ch2.volume = gb->apu.regs.nr22.initial_envelope_volume;
-            gb->apu.ch2.volume_step = apu_volume_step(gb->apu.regs.nr22.envelope_sweep);
+            gb->apu.ch2.envelope_timer = gb->apu.regs.nr22.envelope_sweep;
             return true;
 
-        case SOUND_NR23:
-            (*((byte_t *) &gb->apu.regs.nr23)) = value;
-            gb->apu.ch2.freq = apu_tone_freq(apu_freq11(gb->apu.regs.nr23, gb->apu.regs.nr24));
-            return true;
+        case SOUND_NR23: (*((byte_t *) &gb->apu.regs.nr23)) = value; return true;
 
         case SOUND_NR24:
             (*((byte_t *) &gb->apu.regs.nr24)) = value;
-            gb->apu.ch2.freq = apu_tone_freq(apu_freq11(gb->apu.regs.nr23, gb->apu.regs.nr24));
-            sound_reg_trigger_event(value, gb);
+            sound_reg_trigger_event(2, value, gb);
             return true;
 
         case SOUND_NR30:
             (*((byte_t *) &gb->apu.regs.nr30)) = value;
-            if (gb->apu.regs.nr30.active)
+            if (gb->apu.regs.nr30.active) {
                 gb->apu.regs.nr52.ch3_on = 1;
+            } else {
+                gb->apu.regs.nr52.ch3_on = 0;
+            }
             return true;
 
         case SOUND_NR31:
@@ -149,33 +130,32 @@ bool sound_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
             return true;
 
         case SOUND_NR32: (*((byte_t *) &gb->apu.regs.nr32)) = value; return true;
-        case SOUND_NR33:
-            (*((byte_t *) &gb->apu.regs.nr33)) = value;
-            ch3_update_playback_speed(gb);
-            return true;
+        case SOUND_NR33: (*((byte_t *) &gb->apu.regs.nr33)) = value; return true;
 
         case SOUND_NR34:
             (*((byte_t *) &gb->apu.regs.nr34)) = value;
-            ch3_update_playback_speed(gb);
-            sound_reg_trigger_event(value, gb);
+            sound_reg_trigger_event(3, value, gb);
+            return true;
+
+        case SOUND_NR41:
+            (*((byte_t *) &gb->apu.regs.nr41)) = value;
+            gb->apu.ch4.length = apu_sound_length(gb->apu.regs.nr41.sound_length);
             return true;
 
-        case SOUND_NR41: (*((byte_t *) &gb->apu.regs.nr41)) = value; return true;
         case SOUND_NR42:
             (*((byte_t *) &gb->apu.regs.nr42)) = value;
             gb->apu.ch4.volume = gb->apu.regs.nr42.initial_envelope_volume;
-            gb->apu.ch4.volume_step = apu_volume_step(gb->apu.regs.nr42.envelope_sweep);
+            gb->apu.ch4.envelope_timer = gb->apu.regs.nr42.envelope_sweep;
             return true;
 
         case SOUND_NR43:
             (*((byte_t *) &gb->apu.regs.nr43)) = value;
-            gb->apu.ch4.freq = apu_noise_freq(gb->apu.regs.nr43.dividing_ratio,
-                                              gb->apu.regs.nr43.shift_clock_freq);
+            apu_lfsr_set_width(gb);
             return true;
 
         case SOUND_NR44:
             (*((byte_t *) &gb->apu.regs.nr44)) = value;
-            sound_reg_trigger_event(value, gb);
+            sound_reg_trigger_event(4, value, gb);
             return true;
 
         case SOUND_NR50: (*((byte_t *) &gb->apu.regs.nr50)) = value; return true;
@@ -204,4 +184,16 @@ bool sound_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
             return false;
     }
     return true;
+}
+
+bool sound_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
+{
+    bool ret;
+
+    // Emulate the APU up to this cycle so that the write is applied at the
+    // right time
+    apu_sync(gb);
+    ret = sound_reg_write(addr, value, gb);
+    apu_update_mix(gb);
+    return ret;
 }
\ No newline at end of file
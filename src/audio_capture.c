@@ -0,0 +1,174 @@
+/*
+audio_capture.c
+Write audio samples to a WAV or raw file from a background thread
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "audio_capture.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Write a little-endian integer of size bytes
+static void audio_capture_write_le(FILE *file, uint32_t value, const int size)
+{
+    for (int i = 0; i < size; ++i, value >>= 8)
+        fputc(value & 0xFF, file);
+}
+
+// Write the WAV header of a mono 32-bit float stream of samples
+// It is written with the final size when the capture is closed
+static void audio_capture_write_header(audio_capture_t *ac, const uint64_t samples)
+{
+    const uint32_t data_size = samples * sizeof(float);
+
+    fwrite("RIFF", 1, 4, ac->file);
+    audio_capture_write_le(ac->file, 4 + 26 + 12 + 8 + data_size, 4);
+    fwrite("WAVE", 1, 4, ac->file);
+
+    fwrite("fmt ", 1, 4, ac->file);
+    audio_capture_write_le(ac->file, 18, 4);                       // Chunk size
+    audio_capture_write_le(ac->file, 3, 2);                        // IEEE float
+    audio_capture_write_le(ac->file, 1, 2);                        // Channels
+    audio_capture_write_le(ac->file, ac->rate, 4);                 // Sample rate
+    audio_capture_write_le(ac->file, ac->rate * sizeof(float), 4); // Byte rate
+    audio_capture_write_le(ac->file, sizeof(float), 2);            // Block align
+    audio_capture_write_le(ac->file, 32, 2);                       // Bits per sample
+    audio_capture_write_le(ac->file, 0, 2);                        // Extension size
+
+    fwrite("fact", 1, 4, ac->file);
+    audio_capture_write_le(ac->file, 4, 4);
+    audio_capture_write_le(ac->file, samples, 4);
+
+    fwrite("data", 1, 4, ac->file);
+    audio_capture_write_le(ac->file, data_size, 4);
+}
+
+// Capture thread, writes the samples until the capture is closed
+static void *audio_capture_thread(void *data)
+{
+    audio_capture_t *ac = (audio_capture_t *) data;
+    float chunk[AUDIO_CAPTURE_CHUNK_SIZE];
+    size_t count;
+
+    while (true) {
+        pthread_mutex_lock(&ac->lock);
+        while (ring_buffer_count(&ac->ring) == 0 && !ac->closing)
+            pthread_cond_wait(&ac->data_ready, &ac->lock);
+        pthread_mutex_unlock(&ac->lock);
+
+        if ((count = ring_buffer_pop(&ac->ring, chunk, AUDIO_CAPTURE_CHUNK_SIZE)) == 0)
+            break; // Closing and nothing left to write
+
+        pthread_mutex_lock(&ac->lock);
+        pthread_cond_signal(&ac->space_ready);
+        pthread_mutex_unlock(&ac->lock);
+
+        if (!ac->error && fwrite(chunk, sizeof(float), count, ac->file) != count) {
+            logger(LOG_ERROR, "audio_capture: write failed: %s", strerror(errno));
+            ac->error = true;
+        }
+        ac->written += count;
+    }
+    return NULL;
+}
+
+// Open filename to capture mono samples at rate Hz
+// Files ending with .raw only contain 32-bit float samples, other files are
+// written as WAV
+// Returns NULL on error
+audio_capture_t *audio_capture_open(const char *filename, const uint32_t rate)
+{
+    audio_capture_t *ac = xzalloc(sizeof(audio_capture_t));
+    size_t len = strlen(filename);
+
+    if (!(ac->file = fopen(filename, "wb"))) {
+        logger(LOG_ERROR, "audio_capture: %s: %s", filename, strerror(errno));
+        free(ac);
+        return NULL;
+    }
+
+    ac->wav = !(len >= 4 && !strcmp(filename + len - 4, ".raw"));
+    ac->rate = rate;
+    if (ac->wav)
+        audio_capture_write_header(ac, 0);
+
+    ring_buffer_init(&ac->ring, sizeof(float), AUDIO_CAPTURE_RING_SIZE);
+    pthread_mutex_init(&ac->lock, NULL);
+    pthread_cond_init(&ac->data_ready, NULL);
+    pthread_cond_init(&ac->space_ready, NULL);
+    if (pthread_create(&ac->thread, NULL, &audio_capture_thread, ac)) {
+        logger(LOG_ERROR, "audio_capture: failed to create the capture thread");
+        fclose(ac->file);
+        ring_buffer_free(&ac->ring);
+        free(ac);
+        return NULL;
+    }
+    return ac;
+}
+
+// Queue count samples to be written
+// Only waits when the capture thread is a whole ring behind
+void audio_capture_write(audio_capture_t *ac, const float *samples, size_t count)
+{
+    size_t pushed;
+
+    while (count > 0) {
+        pushed = ring_buffer_push(&ac->ring, samples, count);
+        samples += pushed;
+        count -= pushed;
+
+        pthread_mutex_lock(&ac->lock);
+        pthread_cond_signal(&ac->data_ready);
+        if (count > 0) {
+            while (ring_buffer_count(&ac->ring) == ac->ring.capacity)
+                pthread_cond_wait(&ac->space_ready, &ac->lock);
+        }
+        pthread_mutex_unlock(&ac->lock);
+    }
+}
+
+// Write the remaining samples and close the capture
+// Returns -1 if the samples could not be written, 0 otherwise
+int audio_capture_close(audio_capture_t *ac)
+{
+    int ret;
+
+    pthread_mutex_lock(&ac->lock);
+    ac->closing = true;
+    pthread_cond_signal(&ac->data_ready);
+    pthread_mutex_unlock(&ac->lock);
+    pthread_join(ac->thread, NULL);
+
+    if (ac->wav && !ac->error) {
+        rewind(ac->file);
+        audio_capture_write_header(ac, ac->written);
+    }
+    if (fclose(ac->file) != 0 && !ac->error) {
+        logger(LOG_ERROR, "audio_capture: close failed: %s", strerror(errno));
+        ac->error = true;
+    }
+    ret = ac->error ? -1 : 0;
+
+    pthread_cond_destroy(&ac->space_ready);
+    pthread_cond_destroy(&ac->data_ready);
+    pthread_mutex_destroy(&ac->lock);
+    ring_buffer_free(&ac->ring);
+    free(ac);
+    return ret;
+}
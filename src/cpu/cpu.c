@@ -22,8 +22,10 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "cpu/opcodes.h"
 #include "cpu/registers.h"
 #include "cpu/interrupts.h"
+#include "cpu/trace.h"
+#include "cpu/profiler.h"
 #include "mmu/mmu.h"
-#include "timer.h"
+#include "scheduler.h"
 #include <stdio.h>
 
 // Fetch byte from PC and increment PC
@@ -56,9 +58,10 @@ int cpu_cycle(gb_system_t *gb)
     byte_t opcode_value;
     const opcode_t *opcode;
     int handler_ret;
+    uint16_t pc;
 
-    // Emulate the built-in timers
-    timer_cycle(gb);
+    // Run the scheduled events
+    scheduler_cycle(gb);
 
     // Emulate real CPU cycles
     if (gb->idle_cycles > 0) {
@@ -78,6 +81,7 @@ int cpu_cycle(gb_system_t *gb)
     } else if (!handler_ret) {
         // No ISR executed, continue on normal operation
         // Fetch and execute opcode
+        pc = gb->pc;
         if ((opcode_value = cpu_fetchb(gb)) == 0xCB) {
             CB = true;
             opcode_value = cpu_fetchb(gb);
@@ -85,6 +89,11 @@ int cpu_cycle(gb_system_t *gb)
         } else {
             opcode = opcode_identify(opcode_value);
         }
+        if (gb->trace) {
+            cpu_trace_push(pc, CB ? (0xCB00 | opcode_value) : opcode_value, gb);
+            if (gb->trace->stop)
+                return OPCODE_EXIT;
+        }
 
         if (opcode) {
             if (CB) {
@@ -102,6 +111,8 @@ int cpu_cycle(gb_system_t *gb)
             }
 
             handler_ret = (*opcode->handler)(opcode, gb);
+            if (handler_ret > 0)
+                profiler_on_instruction(pc, handler_ret, gb);
         } else {
             handler_ret = OPCODE_ILLEGAL;
         }
@@ -120,6 +131,8 @@ int cpu_cycle(gb_system_t *gb)
                     gb->pc - 1,
                     opcode_value);
             }
+            if (gb->trace)
+                cpu_trace_dump(NULL, gb);
         }
         return handler_ret;
     }
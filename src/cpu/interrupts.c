@@ -20,6 +20,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "logger.h"
 #include "cpu/interrupts.h"
 #include "cpu/opcodes/calls.h"
+#include "cpu/profiler.h"
 
 // Execute the prioritary requested interrupt (if enabled)
 // Returns 0 if no ISR is executed
@@ -39,6 +40,7 @@ int cpu_int_isr(gb_system_t *gb)
             logger(LOG_DEBUG, "ISR $%02X", addr);
             gb->interrupts.ime = IME_DISABLE;
             cpu_int_flag_clear(i, gb);
+            profiler_on_interrupt(gb);
             cpu_call(addr, gb);
 
             return ISR_CYCLES;
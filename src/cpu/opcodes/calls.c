@@ -21,18 +21,21 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "cpu/cpu.h"
 #include "cpu/registers.h"
 #include "cpu/opcodes/ld.h"
+#include "cpu/profiler.h"
 
 // Call addr
 void cpu_call(uint16_t addr, gb_system_t *gb)
 {
     cpu_push_u16(gb->pc, gb);
     gb->pc = addr;
+    profiler_on_call(addr, gb);
 }
 
 // Return from call
 void cpu_ret(gb_system_t *gb)
 {
     gb->pc = cpu_pop_u16(gb);
+    profiler_on_ret(gb);
 }
 
 // CALL nn and CALL cc,nn opcodes
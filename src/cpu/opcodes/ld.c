@@ -153,9 +153,10 @@ int opcode_ld_a_n(const opcode_t *opcode, gb_system_t *gb)
 }
 
 // LD B,B
+// Test ROMs use it as a software breakpoint
 int opcode_ld_b_b(const opcode_t *opcode, gb_system_t *gb)
 {
-    gb->regs.b = gb->regs.b;
+    gb->breakpoint = true;
     return opcode->cycles_true;
 }
 
@@ -0,0 +1,418 @@
+/*
+profiler.c
+Guest code profiler
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "cpu/profiler.h"
+#include "cpu/opcodes.h"
+#include "mmu/mmu_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#define PROFILER_NODES_SIZE (256) // Initial number of nodes
+
+static const char *interrupt_names[5] = {
+    "int_vblank", "int_stat", "int_timer", "int_serial", "int_joypad"
+};
+
+// Start profiling the guest code
+void profiler_enable(gb_system_t *gb)
+{
+    profiler_t *profiler;
+
+    profiler_disable(gb);
+    profiler = xzalloc(sizeof(profiler_t));
+    profiler->ram_index = gb->memory.rom.banks_nb * 0x4000;
+    profiler->pcs_nb = profiler->ram_index + 0x8000;
+    profiler->pcs = xzalloc(sizeof(struct profiler_pc) * profiler->pcs_nb);
+
+    profiler->nodes_size = PROFILER_NODES_SIZE;
+    profiler->nodes = xzalloc(sizeof(struct profiler_node) * profiler->nodes_size);
+    profiler->nodes[0].function = PROFILER_ROOT;
+    profiler->nodes_nb = 1;
+    profiler->children_mask = (PROFILER_NODES_SIZE * 2) - 1;
+    profiler->children = xzalloc(sizeof(uint32_t) * (profiler->children_mask + 1));
+    gb->profiler = profiler;
+}
+
+void profiler_disable(gb_system_t *gb)
+{
+    if (gb->profiler) {
+        free(gb->profiler->pcs);
+        free(gb->profiler->nodes);
+        free(gb->profiler->children);
+        free(gb->profiler);
+        gb->profiler = NULL;
+    }
+}
+
+static inline size_t profiler_hash(uint32_t parent, uint32_t function)
+{
+    return (parent * 0x9E3779B1u) ^ (function * 0x85EBCA77u);
+}
+
+// Rebuild the hash table with twice as many slots
+static void profiler_grow_children(profiler_t *profiler)
+{
+    size_t slot;
+
+    free(profiler->children);
+    profiler->children_mask = (profiler->children_mask << 1) | 1;
+    profiler->children = xzalloc(sizeof(uint32_t) * (profiler->children_mask + 1));
+    for (uint32_t i = 1; i < profiler->nodes_nb; ++i) {
+        slot = profiler_hash(profiler->nodes[i].parent, profiler->nodes[i].function);
+        while (profiler->children[slot & profiler->children_mask])
+            ++slot;
+        profiler->children[slot & profiler->children_mask] = i + 1;
+    }
+}
+
+// Returns the node of function called from parent, it is created if needed
+static uint32_t profiler_child(uint32_t parent, uint32_t function, profiler_t *profiler)
+{
+    size_t slot = profiler_hash(parent, function);
+    struct profiler_node *node;
+    uint32_t i;
+
+    while ((i = profiler->children[slot & profiler->children_mask])) {
+        node = &profiler->nodes[i - 1];
+        if (node->parent == parent && node->function == function)
+            return i - 1;
+        ++slot;
+    }
+
+    if (profiler->nodes_nb == profiler->nodes_size) {
+        profiler->nodes_size *= 2;
+        profiler->nodes = xrealloc(profiler->nodes,
+            sizeof(struct profiler_node) * profiler->nodes_size);
+    }
+    i = profiler->nodes_nb++;
+    node = &profiler->nodes[i];
+    node->parent = parent;
+    node->function = function;
+    node->calls = 0;
+    node->cycles = 0;
+    profiler->children[slot & profiler->children_mask] = i + 1;
+    if (profiler->nodes_nb * 2 > profiler->children_mask)
+        profiler_grow_children(profiler);
+    return i;
+}
+
+// Leave the functions whose return address is above sp (it was popped)
+// Comparing SP keeps the stack in sync when a function discards its return
+// address (or a RET is used as a jump)
+static void profiler_unwind(uint16_t sp, profiler_t *profiler)
+{
+    while (profiler->depth > 0 && profiler->stack[profiler->depth - 1].sp <= sp)
+        profiler->depth -= 1;
+    profiler->node = profiler->depth > 0 ? profiler->stack[profiler->depth - 1].node : 0;
+}
+
+// Enter the function at addr
+void profiler_call(uint16_t addr, gb_system_t *gb)
+{
+    profiler_t *profiler = gb->profiler;
+    uint32_t function;
+    uint32_t node;
+
+    if (profiler->interrupt) {
+        function = PROFILER_INTERRUPT | addr;
+        profiler->interrupt = false;
+    } else if (addr < 0x4000) {
+        function = (gb->memory.rom.bank_0 << 16) | addr;
+    } else if (addr < 0x8000) {
+        function = (gb->memory.rom.bank_n << 16) | addr;
+    } else {
+        function = addr;
+    }
+
+    // Frames left without a RET are above the return address
+    profiler_unwind(gb->sp + 2, profiler);
+
+    // Calls deeper than the stack are counted in the deepest function
+    if (profiler->depth == PROFILER_MAX_DEPTH)
+        return;
+
+    node = profiler_child(profiler->node, function, profiler);
+    profiler->nodes[node].calls += 1;
+    profiler->stack[profiler->depth].node = node;
+    profiler->stack[profiler->depth].sp = gb->sp + 2;
+    profiler->depth += 1;
+    profiler->node = node;
+}
+
+// Leave the function that returned
+void profiler_ret(gb_system_t *gb)
+{
+    profiler_unwind(gb->sp, gb->profiler);
+}
+
+// Name of a function in the folded stacks and reports
+static void profiler_function_name(char *name, size_t size, uint32_t function)
+{
+    const uint16_t addr = function & 0xFFFF;
+
+    if (function == PROFILER_ROOT) {
+        snprintf(name, size, "main");
+    } else if (function & PROFILER_INTERRUPT) {
+        if (addr >= INT_VBLANK && addr <= INT_VBLANK + 4 * 8 && (addr & 7) == 0) {
+            snprintf(name, size, "%s", interrupt_names[(addr - INT_VBLANK) / 8]);
+        } else {
+            snprintf(name, size, "int_%04X", addr);
+        }
+    } else if (addr >= 0x8000) {
+        snprintf(name, size, "ram_%04X", addr);
+    } else {
+        snprintf(name, size, "%02X:%04X", function >> 16, addr);
+    }
+}
+
+// Name of the location of pcs[index]
+static void profiler_location_name(char *name, size_t size, size_t index, profiler_t *profiler)
+{
+    if (index >= profiler->ram_index) {
+        snprintf(name, size, "ram_%04X", (unsigned) (index - profiler->ram_index + 0x8000));
+    } else {
+        snprintf(name, size, "%02X:%04X",
+            (unsigned) (index / 0x4000),
+            (unsigned) ((index / 0x4000 ? 0x4000 : 0) + (index & 0x3FFF)));
+    }
+}
+
+// Opcode at pcs[index] ($CBxx for CB-prefixed opcodes)
+// Code executed from RAM is decoded from what the RAM contains now
+static uint16_t profiler_opcode(size_t index, gb_system_t *gb)
+{
+    const profiler_t *profiler = gb->profiler;
+    byte_t opcode;
+    byte_t next;
+
+    if (index >= profiler->ram_index) {
+        uint16_t addr = index - profiler->ram_index + 0x8000;
+
+        opcode = mmu_internal_readb(addr, gb);
+        next = mmu_internal_readb(addr + 1, gb);
+    } else {
+        const byte_t *bank = gb->memory.rom.banks[index / 0x4000];
+
+        opcode = bank[index & 0x3FFF];
+        next = (index & 0x3FFF) < 0x3FFF ? bank[(index & 0x3FFF) + 1] : 0;
+    }
+    return opcode == 0xCB ? (0xCB00 | next) : opcode;
+}
+
+static const char *profiler_mnemonic(uint16_t opcode)
+{
+    const opcode_t *op = (opcode & 0xFF00) ? opcode_cb_identify(opcode & 0xFF)
+                                           : opcode_identify(opcode);
+
+    return op ? op->mnemonic : "(illegal)";
+}
+
+// Write the call stacks in the folded format used by flamegraph tools, one
+// line per stack with the cycles spent in its innermost function
+// Returns false on error
+bool profiler_write_folded(const char *filename, gb_system_t *gb)
+{
+    const profiler_t *profiler = gb->profiler;
+    uint32_t path[PROFILER_MAX_DEPTH + 1];
+    char name[32];
+    FILE *file;
+    int depth;
+
+    if (!(file = fopen(filename, "w"))) {
+        logger(LOG_ERROR, "profiler: %s: %s", filename, strerror(errno));
+        return false;
+    }
+
+    for (uint32_t i = 0; i < profiler->nodes_nb; ++i) {
+        if (!profiler->nodes[i].cycles)
+            continue;
+
+        depth = 0;
+        for (uint32_t node = i; node != 0; node = profiler->nodes[node].parent)
+            path[depth++] = node;
+        path[depth++] = 0;
+
+        while (depth-- > 0) {
+            profiler_function_name(name, sizeof(name), profiler->nodes[path[depth]].function);
+            fprintf(file, depth ? "%s;" : "%s", name);
+        }
+        fprintf(file, " %" PRIu64 "\n", profiler->nodes[i].cycles);
+    }
+
+    if (fclose(file) != 0) {
+        logger(LOG_ERROR, "profiler: %s: %s", filename, strerror(errno));
+        return false;
+    }
+    logger(LOG_INFO, "profiler: Wrote %zu call stacks to %s", profiler->nodes_nb, filename);
+    return true;
+}
+
+struct profiler_entry {
+    uint32_t key;
+    uint64_t count;
+    uint64_t cycles;
+};
+
+static int profiler_entry_cmp_key(const void *a, const void *b)
+{
+    const struct profiler_entry *ea = a;
+    const struct profiler_entry *eb = b;
+
+    return (ea->key > eb->key) - (ea->key < eb->key);
+}
+
+static int profiler_entry_cmp_cycles(const void *a, const void *b)
+{
+    const struct profiler_entry *ea = a;
+    const struct profiler_entry *eb = b;
+
+    return (ea->cycles < eb->cycles) - (ea->cycles > eb->cycles);
+}
+
+static int profiler_entry_cmp_count(const void *a, const void *b)
+{
+    const struct profiler_entry *ea = a;
+    const struct profiler_entry *eb = b;
+
+    return (ea->count < eb->count) - (ea->count > eb->count);
+}
+
+// Sum the entries that have the same key, returns the new number of entries
+static size_t profiler_merge(struct profiler_entry *entries, size_t entries_nb)
+{
+    size_t merged = 0;
+
+    qsort(entries, entries_nb, sizeof(struct profiler_entry), profiler_entry_cmp_key);
+    for (size_t i = 0; i < entries_nb; ++i) {
+        if (merged > 0 && entries[merged - 1].key == entries[i].key) {
+            entries[merged - 1].count += entries[i].count;
+            entries[merged - 1].cycles += entries[i].cycles;
+        } else {
+            entries[merged++] = entries[i];
+        }
+    }
+    return merged;
+}
+
+static inline double profiler_percent(uint64_t value, uint64_t total)
+{
+    return total ? (value * 100.0) / total : 0.0;
+}
+
+// Print the top hotspots, functions, call edges and opcodes
+void profiler_report(FILE *file, int top, gb_system_t *gb)
+{
+    const profiler_t *profiler = gb->profiler;
+    struct profiler_entry *entries;
+    size_t entries_nb = 0;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    char name[32];
+    char caller[32];
+    size_t size;
+
+    size = profiler->pcs_nb > profiler->nodes_nb ? profiler->pcs_nb : profiler->nodes_nb;
+    entries = xalloc(sizeof(struct profiler_entry) * size);
+
+    // Hotspots
+    for (size_t i = 0; i < profiler->pcs_nb; ++i) {
+        if (!profiler->pcs[i].instructions)
+            continue;
+        entries[entries_nb].key = i;
+        entries[entries_nb].count = profiler->pcs[i].instructions;
+        entries[entries_nb].cycles = profiler->pcs[i].cycles;
+        instructions += profiler->pcs[i].instructions;
+        cycles += profiler->pcs[i].cycles;
+        entries_nb += 1;
+    }
+    qsort(entries, entries_nb, sizeof(struct profiler_entry), profiler_entry_cmp_cycles);
+
+    fprintf(file, "Profiled %" PRIu64 " instructions, %" PRIu64 " cycles\n", instructions, cycles);
+    fprintf(file, "\nHotspots (%% of cycles, cycles, instructions):\n");
+    for (size_t i = 0; i < entries_nb && i < (size_t) top; ++i) {
+        profiler_location_name(name, sizeof(name), entries[i].key, gb->profiler);
+        fprintf(file, "  %6.2f%%  %12" PRIu64 "  %12" PRIu64 "  %-9s %s\n",
+            profiler_percent(entries[i].cycles, cycles),
+            entries[i].cycles,
+            entries[i].count,
+            name,
+            profiler_mnemonic(profiler_opcode(entries[i].key, gb)));
+    }
+
+    // Opcode mix, decoded from the hotspots
+    for (size_t i = 0; i < entries_nb; ++i)
+        entries[i].key = profiler_opcode(entries[i].key, gb);
+    entries_nb = profiler_merge(entries, entries_nb);
+    qsort(entries, entries_nb, sizeof(struct profiler_entry), profiler_entry_cmp_count);
+
+    fprintf(file, "\nOpcodes (%% of instructions, instructions, cycles):\n");
+    for (size_t i = 0; i < entries_nb && i < (size_t) top; ++i) {
+        fprintf(file, "  %6.2f%%  %12" PRIu64 "  %12" PRIu64 "  %s\n",
+            profiler_percent(entries[i].count, instructions),
+            entries[i].count,
+            entries[i].cycles,
+            profiler_mnemonic(entries[i].key));
+    }
+
+    // Functions (self cycles, all call sites)
+    entries_nb = 0;
+    for (size_t i = 0; i < profiler->nodes_nb; ++i) {
+        entries[entries_nb].key = profiler->nodes[i].function;
+        entries[entries_nb].count = profiler->nodes[i].calls;
+        entries[entries_nb].cycles = profiler->nodes[i].cycles;
+        entries_nb += 1;
+    }
+    entries_nb = profiler_merge(entries, entries_nb);
+    qsort(entries, entries_nb, sizeof(struct profiler_entry), profiler_entry_cmp_cycles);
+
+    fprintf(file, "\nFunctions (%% of cycles, self cycles, calls):\n");
+    for (size_t i = 0; i < entries_nb && i < (size_t) top; ++i) {
+        profiler_function_name(name, sizeof(name), entries[i].key);
+        fprintf(file, "  %6.2f%%  %12" PRIu64 "  %12" PRIu64 "  %s\n",
+            profiler_percent(entries[i].cycles, cycles),
+            entries[i].cycles,
+            entries[i].count,
+            name);
+    }
+
+    // Call edges
+    entries_nb = 0;
+    for (size_t i = 1; i < profiler->nodes_nb; ++i) {
+        entries[entries_nb].key = i;
+        entries[entries_nb].count = profiler->nodes[i].calls;
+        entries[entries_nb].cycles = 0;
+        entries_nb += 1;
+    }
+    qsort(entries, entries_nb, sizeof(struct profiler_entry), profiler_entry_cmp_count);
+
+    fprintf(file, "\nCall edges (calls):\n");
+    for (size_t i = 0; i < entries_nb && i < (size_t) top; ++i) {
+        const struct profiler_node *node = &profiler->nodes[entries[i].key];
+
+        profiler_function_name(caller, sizeof(caller), profiler->nodes[node->parent].function);
+        profiler_function_name(name, sizeof(name), node->function);
+        fprintf(file, "  %12" PRIu64 "  %s -> %s\n", entries[i].count, caller, name);
+    }
+
+    free(entries);
+}
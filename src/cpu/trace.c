@@ -0,0 +1,288 @@
+/*
+trace.c
+Binary trace of the instructions executed by the CPU
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "cpu/trace.h"
+#include "mmu/mmu.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static bool cpu_trace_write_header(FILE *file)
+{
+    struct cpu_trace_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CPU_TRACE_MAGIC, sizeof(CPU_TRACE_MAGIC));
+    header.version = CPU_TRACE_VERSION;
+    header.record_size = sizeof(struct cpu_trace_record);
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+// Write the records first to last - 1 of the ring to file
+static size_t cpu_trace_write(cpu_trace_t *trace, size_t first, const size_t last, FILE *file)
+{
+    size_t start, count, written = 0;
+
+    while (first < last) {
+        start = first & trace->mask;
+        count = trace->mask + 1 - start;
+        if (count > last - first)
+            count = last - first;
+
+        written += fwrite(&trace->records[start], sizeof(struct cpu_trace_record), count, file);
+        first += count;
+    }
+    return written;
+}
+
+// Record the last size instructions (rounded up to a power of two)
+// dump_file is written when an illegal opcode is executed or when
+// cpu_trace_dump() is called without a filename
+void cpu_trace_enable(size_t size, const char *dump_file, gb_system_t *gb)
+{
+    size_t ring_size = 2;
+
+    while (ring_size < size)
+        ring_size <<= 1;
+
+    cpu_trace_disable(gb);
+    gb->trace = xzalloc(sizeof(cpu_trace_t));
+    gb->trace->records = xalloc(sizeof(struct cpu_trace_record) * ring_size);
+    gb->trace->mask = ring_size - 1;
+    gb->trace->dump_file = dump_file ? xstrdup(dump_file) : NULL;
+}
+
+// Also write every record to filename
+// The trace must be enabled (same for the gameboy-doctor logs)
+// Returns false on error
+bool cpu_trace_stream(const char *filename, gb_system_t *gb)
+{
+    FILE *file;
+
+    if (!(file = fopen(filename, "wb")) || !cpu_trace_write_header(file)) {
+        logger(LOG_ERROR, "cpu_trace: %s: %s", filename, strerror(errno));
+        if (file)
+            fclose(file);
+        return false;
+    }
+
+    if (gb->trace->stream)
+        fclose(gb->trace->stream);
+    gb->trace->stream = file;
+    gb->trace->streamed = gb->trace->count;
+    return true;
+}
+
+// Write the records that were not streamed yet
+// If the emulation got a whole ring ahead, the oldest records are lost
+void cpu_trace_flush_stream(cpu_trace_t *trace)
+{
+    const size_t size = trace->mask + 1;
+
+    if (trace->count - trace->streamed > size) {
+        logger(LOG_WARN, "cpu_trace: %zu records were not streamed",
+            trace->count - trace->streamed - size);
+        trace->streamed = trace->count - size;
+    }
+    cpu_trace_write(trace, trace->streamed, trace->count, trace->stream);
+    trace->streamed = trace->count;
+}
+
+// Write the records of the ring to filename (trace->dump_file if NULL)
+// Returns false on error
+bool cpu_trace_dump(const char *filename, gb_system_t *gb)
+{
+    cpu_trace_t *trace = gb->trace;
+    size_t first = trace->count > trace->mask ? trace->count - trace->mask - 1 : 0;
+    FILE *file;
+    bool ret;
+
+    if (!filename && !(filename = trace->dump_file))
+        return false;
+
+    if (!(file = fopen(filename, "wb"))) {
+        logger(LOG_ERROR, "cpu_trace: %s: %s", filename, strerror(errno));
+        return false;
+    }
+
+    ret = cpu_trace_write_header(file)
+       && cpu_trace_write(trace, first, trace->count, file) == trace->count - first;
+    if (fclose(file) != 0 || !ret) {
+        logger(LOG_ERROR, "cpu_trace: %s: Write failed", filename);
+        return false;
+    }
+
+    logger(LOG_INFO, "cpu_trace: Dumped %zu instructions to %s", trace->count - first, filename);
+    return true;
+}
+
+// Format a record as a gameboy-doctor line (without a newline)
+static void cpu_trace_format(char *line, const struct cpu_trace_record *record, gb_system_t *gb)
+{
+    snprintf(line, CPU_TRACE_LINE_SIZE,
+        "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+        record->a, record->f, record->b, record->c, record->d, record->e,
+        record->h, record->l, record->sp, record->pc,
+        mmu_readb_nolog(record->pc, gb),
+        mmu_readb_nolog(record->pc + 1, gb),
+        mmu_readb_nolog(record->pc + 2, gb),
+        mmu_readb_nolog(record->pc + 3, gb));
+}
+
+// Open filename for a gameboy-doctor log ("-" for the standard input or
+// output), the LY register is stubbed to match the reference emulators
+// Returns NULL on error
+static FILE *cpu_trace_open_log(const char *filename, const char *mode, gb_system_t *gb)
+{
+    FILE *file;
+
+    if (!strcmp(filename, "-")) {
+        file = mode[0] == 'r' ? stdin : stdout;
+    } else if (!(file = fopen(filename, mode))) {
+        logger(LOG_ERROR, "cpu_trace: %s: %s", filename, strerror(errno));
+        return NULL;
+    }
+
+    gb->trace->doctor = true;
+    gb->screen.ly_stub = true;
+    return file;
+}
+
+static void cpu_trace_close_log(FILE *file)
+{
+    if (file == stdout)
+        fflush(file);
+    else if (file != stdin)
+        fclose(file);
+}
+
+// Log every instruction to filename in the gameboy-doctor format
+// Returns false on error
+bool cpu_trace_log(const char *filename, gb_system_t *gb)
+{
+    FILE *file;
+
+    if (!(file = cpu_trace_open_log(filename, "w", gb)))
+        return false;
+    if (gb->trace->log)
+        cpu_trace_close_log(gb->trace->log);
+    gb->trace->log = file;
+    return true;
+}
+
+// Compare every instruction with the gameboy-doctor log in filename, the
+// emulation stops at the first divergence
+// The reference is read one line at a time
+// Returns false on error
+bool cpu_trace_compare(const char *filename, gb_system_t *gb)
+{
+    FILE *file;
+
+    if (!(file = cpu_trace_open_log(filename, "r", gb)))
+        return false;
+    if (gb->trace->reference)
+        cpu_trace_close_log(gb->trace->reference);
+    gb->trace->reference = file;
+    gb->trace->line = 0;
+    gb->trace->diverged = false;
+    gb->trace->stop = false;
+    return true;
+}
+
+// Print the instructions that led to a divergence, the expected line and
+// the first column that differs
+// The instructions are printed as they were formatted when they ran, as the
+// memory around them may have changed since
+static void cpu_trace_print_divergence(const char *expected, const char *line, gb_system_t *gb)
+{
+    cpu_trace_t *trace = gb->trace;
+    size_t context = trace->line - 1;
+    size_t column = 0;
+
+    if (context > CPU_TRACE_CONTEXT)
+        context = CPU_TRACE_CONTEXT;
+
+    printf("Diverged from the reference at line %zu (cycle #%zu)\n", trace->line, gb->cycle_nb);
+    for (size_t i = context; i > 0; --i)
+        printf("   %8zu: %s\n", trace->line - i, trace->context[(trace->line - i) % CPU_TRACE_CONTEXT]);
+
+    while (expected[column] && line[column] && expected[column] == line[column])
+        column += 1;
+    printf("Expected %8zu: %s\n", trace->line, expected);
+    printf("Got      %8zu: %s\n", trace->line, line);
+    printf("         %8s  %*s^\n", "", (int) column, "");
+}
+
+// Log and/or compare an instruction with the reference
+void cpu_trace_doctor(const struct cpu_trace_record *record, gb_system_t *gb)
+{
+    cpu_trace_t *trace = gb->trace;
+    char line[CPU_TRACE_LINE_SIZE];
+    char expected[CPU_TRACE_LINE_SIZE + 2];
+    size_t len;
+
+    cpu_trace_format(line, record, gb);
+    if (trace->log) {
+        fputs(line, trace->log);
+        fputc('\n', trace->log);
+    }
+
+    if (!trace->reference || trace->stop)
+        return;
+
+    if (!fgets(expected, sizeof(expected), trace->reference)) {
+        printf("Reached the end of the reference after %zu lines\n", trace->line);
+        trace->stop = true;
+        return;
+    }
+    trace->line += 1;
+    len = strcspn(expected, "\r\n");
+    expected[len] = '\0';
+
+    if (strcasecmp(expected, line)) {
+        cpu_trace_print_divergence(expected, line, gb);
+        trace->diverged = true;
+        trace->stop = true;
+    } else {
+        memcpy(trace->context[trace->line % CPU_TRACE_CONTEXT], line, sizeof(line));
+    }
+}
+
+// Stop recording, the stream is flushed and closed
+void cpu_trace_disable(gb_system_t *gb)
+{
+    if (!gb->trace)
+        return;
+
+    if (gb->trace->stream) {
+        cpu_trace_flush_stream(gb->trace);
+        fclose(gb->trace->stream);
+    }
+    if (gb->trace->log)
+        cpu_trace_close_log(gb->trace->log);
+    if (gb->trace->reference)
+        cpu_trace_close_log(gb->trace->reference);
+    free(gb->trace->dump_file);
+    free(gb->trace->records);
+    free(gb->trace);
+    gb->trace = NULL;
+}
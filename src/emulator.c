@@ -24,11 +24,15 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "mmu_view.h"
 #include "gb_system.h"
 #include "cpu/cpu.h"
+#include "cpu/trace.h"
 #include "mmu/mmu.h"
 #include "ppu/ppu.h"
 #include "apu/apu.h"
+#include "apu/resampler.h"
 #include "joypad.h"
 #include "serial.h"
+#include "triple_buffer.h"
+#include "ring_buffer.h"
 #include <stdio.h>
 #include <SDL.h>
 #include <SDL_audio.h>
@@ -47,12 +51,13 @@ static const Uint32 surface_amask = 0xff000000;
 #endif
 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define SetRenderBackgroundColor(ren) SDL_SetRenderDrawColor(ren, 32, 32, 32, 255)
 #define audio_sample_rate        (48000)
-#define audio_buffer_samples     (audio_sample_rate / 60) // ~16.6ms latency
-#define audio_buffer_size        (audio_buffer_samples * sizeof(float))
-#define audio_sample_duration    (1.0 / (double) audio_sample_rate)
-#define audio_sample_duration_ms (1000.0 / (double) audio_sample_rate)
+#define audio_buffer_samples     (512)                      // ~10.7ms per callback
+#define audio_ring_samples       (8192)
+#define audio_target_fill        (audio_buffer_samples * 3) // ~32ms latency
+#define audio_max_ratio_delta    (0.005)                    // +-0.5% pitch
 
 // TODO: Add customizable key mappings
 
@@ -62,9 +67,8 @@ static SDL_Window    *lcd_win             = NULL;
 static SDL_Renderer  *lcd_ren             = NULL;
 static TTF_Font      *lcd_font            = NULL;
 static int            lcd_font_height     = 0;
-static double         lcd_win_clock_freq  = 0.0;
-static double         lcd_win_clock_speed = 0.0;
-static uint32_t       lcd_win_framerate   = 0;
+static SDL_atomic_t   lcd_win_clocks;             // Clocks of the last second (emulation thread)
+static SDL_atomic_t   lcd_win_framerate;          // Frames of the last second (emulation thread)
 static int            lcd_win_width       = 0;
 static int            lcd_win_height      = 0;
 static SDL_Surface   *screen_surface      = NULL;
@@ -77,29 +81,50 @@ static const SDL_Rect screen_src          = {.x = 0,
                                              .w = SCREEN_WIDTH,
                                              .h = SCREEN_HEIGHT};
 
-static bool     stop_emulation    = false;
-static bool     pause_emulation   = false;
-static uint32_t frames_per_second = 0;
+// Emulation runs on its own thread, frames are passed to the main thread
+// (rendering and events) through a triple buffer
+static SDL_Thread      *emu_thread = NULL;
+static triple_buffer_t *lcd_frames = NULL;
+
+static SDL_atomic_t stop_emulation;
+static SDL_atomic_t pause_emulation;
+static SDL_atomic_t requested_clock_speed;
+static SDL_atomic_t trace_dump_request;
+static uint32_t     frames_per_second = 0;
+
+// Joypad inputs from the main thread, applied by the emulation thread
+#define JOYPAD_QUEUE_SIZE (32)
+static struct joypad_input {
+    byte_t button;
+    bool pressed;
+} joypad_queue[JOYPAD_QUEUE_SIZE];
+static SDL_atomic_t joypad_queue_head; // Written by the main thread
+static SDL_atomic_t joypad_queue_tail; // Written by the emulation thread
 
 static size_t   clocks_per_second = 0;
 static uint32_t clock_speed       = CPU_CLOCK_SPEED;
 static uint32_t frameskip         = 0;
 
+// Samples are produced by the emulation thread and consumed by the audio
+// callback through a lock-free ring
 static SDL_AudioDeviceID audio_devid       = 0;
-static int               audio_pos         = 0;
-static double            audio_prev_volume = 0.5;
+static ring_buffer_t     audio_ring;
+static resampler_t      *audio_resampler   = NULL; // Used by the emulation thread
+static float            *audio_resampled   = NULL;
+static double            audio_fill        = 0.0;  // Smoothed fill level of the ring
+static int               audio_prev_volume = 500;
 static bool              audio_scaled      = false;
-static double            audio_volume      = 0.5;
-#define audio_volume_step (0.05)
-#define audio_muted       (audio_volume <= 0.0)
+static SDL_atomic_t      audio_volume      = { 500 }; // Per mille, read by the audio callback
+#define audio_volume_step (50)
+#define audio_muted       (SDL_AtomicGet(&audio_volume) <= 0)
 
 // Scale audio volume by percent
 static inline void audio_scale(const double percent)
 {
     if (!audio_scaled) {
         audio_scaled = true;
-        audio_prev_volume = audio_volume;
-        audio_volume *= percent;
+        audio_prev_volume = SDL_AtomicGet(&audio_volume);
+        SDL_AtomicSet(&audio_volume, (int) (audio_prev_volume * percent));
     }
 }
 
@@ -108,15 +133,14 @@ static inline void audio_unscale(void)
 {
     if (audio_scaled) {
         audio_scaled = false;
-        audio_volume = audio_prev_volume;
+        SDL_AtomicSet(&audio_volume, audio_prev_volume);
     }
 }
 
-// Returns the elapsed audio time in seconds since the program start
-static double audio_time(void)
+// Step the audio volume, clamped between muted and full volume
+static inline void audio_step_volume(const int step)
 {
-    static double atime = 0.0;
-    return (atime += audio_sample_duration);
+    SDL_AtomicSet(&audio_volume, MAX(0, MIN(SDL_AtomicGet(&audio_volume) + step, 1000)));
 }
 
 // Update scales and positions using the window size
@@ -135,6 +159,7 @@ void update_window_size()
 
 static void update_emulator_window_title(gb_system_t *gb)
 {
+    const double clocks = (double) SDL_AtomicGet(&lcd_win_clocks);
     static char audio_fmt[32];
 
     if (audio_devid == 0) {
@@ -143,23 +168,54 @@ static void update_emulator_window_title(gb_system_t *gb)
         snprintf(audio_fmt, sizeof(audio_fmt), "volume: muted");
     } else {
         snprintf(audio_fmt, sizeof(audio_fmt), "volume: %.f%%",
-            (float) (audio_volume * 100.0));
+            (float) SDL_AtomicGet(&audio_volume) / 10.0f);
     }
 
     update_window_title(lcd_win,
         "Gameboy (%s) (%.06f MHz: %.02f%%, %u fps, %s)",
         gb->cartridge.title,
-        lcd_win_clock_freq,
-        lcd_win_clock_speed,
-        lcd_win_framerate,
+        clocks / 1000000.0,
+        clocks / (double) CPU_CLOCK_SPEED * 100.0,
+        (uint32_t) SDL_AtomicGet(&lcd_win_framerate),
         audio_fmt);
 }
 
+// Copy the latest published frame to the screen_surface buffer
+void update_screen_surface(void)
+{
+    const frame_t *frame;
+    uint32_t color;
+
+    if (!triple_buffer_acquire(lcd_frames))
+        return;
+
+    frame = triple_buffer_front(lcd_frames);
+    for (byte_t y = 0; y < SCREEN_HEIGHT; ++y) {
+        for (byte_t x = 0; x < SCREEN_WIDTH; ++x) {
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+            color =   ((*frame)[y][x].r << 24)
+                    | ((*frame)[y][x].g << 16)
+                    | ((*frame)[y][x].b << 8)
+                    |  0xff;
+#else
+            color =    0xff000000
+                    | ((*frame)[y][x].b << 16)
+                    | ((*frame)[y][x].g << 8)
+                    | ((*frame)[y][x].r << 0);
+#endif
+            ((uint32_t *) screen_surface->pixels)[(x + (y * SCREEN_WIDTH))] = color;
+        }
+    }
+}
+
 // Render a frame
-void render_frame(__attribute__((unused)) gb_system_t *gb)
+void render_frame(void)
 {
     SDL_Texture *screen_texture;
 
+    update_screen_surface();
+
     // Clear the window
     SetRenderBackgroundColor(lcd_ren);
     SDL_RenderClear(lcd_ren);
@@ -169,47 +225,30 @@ void render_frame(__attribute__((unused)) gb_system_t *gb)
     SDL_RenderCopy(lcd_ren, screen_texture, &screen_src, &screen_dst);
     SDL_DestroyTexture(screen_texture);
 
-    if (pause_emulation) {
+    if (SDL_AtomicGet(&pause_emulation)) {
         render_text_outline(lcd_font, lcd_ren, 3, 3,  "Paused");
     }
 
-    // Update display and increment frame counter
+    // Update display
     SDL_RenderPresent(lcd_ren);
-    frames_per_second += 1;
 }
 
-// Update the GameBoy framebuffer to the screen_surface buffer and render frame
+// Publish the GameBoy framebuffer to the main thread (V-Blank callback)
 void render_framebuffer(gb_system_t *gb)
 {
     static uint32_t frameskip_counter = 0;
-    uint32_t color;
 
     if (frameskip_counter == 0) {
-        for (byte_t y = 0; y < SCREEN_HEIGHT; ++y) {
-            for (byte_t x = 0; x < SCREEN_WIDTH; ++x) {
-
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-                color =   (gb->screen.framebuffer[y][x].r << 24)
-                        | (gb->screen.framebuffer[y][x].g << 16)
-                        | (gb->screen.framebuffer[y][x].b << 8)
-                        |  0xff;
-#else
-                color =    0xff000000
-                        | (gb->screen.framebuffer[y][x].b << 16)
-                        | (gb->screen.framebuffer[y][x].g << 8)
-                        | (gb->screen.framebuffer[y][x].r << 0);
-#endif
-                ((uint32_t *) screen_surface->pixels)[(x + (y * SCREEN_WIDTH))] = color;
-            }
-        }
-
-        render_frame(gb);
+        memcpy(triple_buffer_back(lcd_frames), gb->screen.framebuffer, sizeof(frame_t));
+        triple_buffer_publish(lcd_frames);
+        frames_per_second += 1;
     }
     if ((++frameskip_counter) > frameskip)
         frameskip_counter = 0;
 }
 
 // Change the emulated clock speed and update the frameskip value
+// Only called by the emulation thread, see request_clock_speed()
 void set_clock_speed(uint32_t speed)
 {
     if (clock_speed != speed) {
@@ -223,45 +262,109 @@ void set_clock_speed(uint32_t speed)
     }
 }
 
+// Change the emulated clock speed from the main thread
+static inline void request_clock_speed(uint32_t speed)
+{
+    SDL_AtomicSet(&requested_clock_speed, (int) speed);
+}
+
+// Queue a joypad input for the emulation thread
+// The input is dropped if the queue is full
+void queue_joypad_input(const byte_t button, const bool pressed)
+{
+    int head = SDL_AtomicGet(&joypad_queue_head);
+    int next = (head + 1) % JOYPAD_QUEUE_SIZE;
+
+    if (next == SDL_AtomicGet(&joypad_queue_tail))
+        return;
+
+    joypad_queue[head].button = button;
+    joypad_queue[head].pressed = pressed;
+    SDL_AtomicSet(&joypad_queue_head, next);
+}
+
+// Apply the queued joypad inputs (emulation thread)
+void apply_joypad_inputs(gb_system_t *gb)
+{
+    int tail = SDL_AtomicGet(&joypad_queue_tail);
+
+    while (tail != SDL_AtomicGet(&joypad_queue_head)) {
+        joypad_button(joypad_queue[tail].button, joypad_queue[tail].pressed, gb);
+        tail = (tail + 1) % JOYPAD_QUEUE_SIZE;
+        SDL_AtomicSet(&joypad_queue_tail, tail);
+    }
+}
+
 // Handle SDL input for the joypad
-void handle_joypad_input(SDL_Event *e, const bool pressed, gb_system_t *gb)
+void handle_joypad_input(SDL_Event *e, const bool pressed)
 {
     if (e->key.keysym.scancode == emu_keymap.gb_up) {
-        joypad_button(BTN_UP, pressed, gb);
+        queue_joypad_input(BTN_UP, pressed);
     } else if (e->key.keysym.scancode == emu_keymap.gb_down) {
-        joypad_button(BTN_DOWN, pressed, gb);
+        queue_joypad_input(BTN_DOWN, pressed);
     } else if (e->key.keysym.scancode == emu_keymap.gb_right) {
-        joypad_button(BTN_RIGHT, pressed, gb);
+        queue_joypad_input(BTN_RIGHT, pressed);
     } else if (e->key.keysym.scancode == emu_keymap.gb_left) {
-        joypad_button(BTN_LEFT, pressed, gb);
+        queue_joypad_input(BTN_LEFT, pressed);
     } else if (e->key.keysym.scancode == emu_keymap.gb_a) {
-        joypad_button(BTN_A, pressed, gb);
+        queue_joypad_input(BTN_A, pressed);
     } else if (e->key.keysym.scancode == emu_keymap.gb_b) {
-        joypad_button(BTN_B, pressed, gb);
+        queue_joypad_input(BTN_B, pressed);
     } else if (e->key.keysym.scancode == emu_keymap.gb_select) {
-        joypad_button(BTN_SELECT, pressed, gb);
+        queue_joypad_input(BTN_SELECT, pressed);
     } else if (e->key.keysym.scancode == emu_keymap.gb_start) {
-        joypad_button(BTN_START, pressed, gb);
+        queue_joypad_input(BTN_START, pressed);
     }
 }
 
+// Generate the samples of the emulated clocks and convert them to the
+// device rate
+// When the emulation runs faster than real time the samples that do not fit
+// in the ring are dropped instead of raising the pitch
+static void emulator_audio_drain(gb_system_t *gb)
+{
+    size_t resampled_count;
+    double ratio_delta;
+
+    apu_sync(gb);
+    resampled_count = resampler_process(audio_resampler, gb->apu.samples, gb->apu.samples_count,
+                                        audio_resampled, APU_SAMPLES_SIZE);
+    gb->apu.samples_count = 0;
+    ring_buffer_push(&audio_ring, audio_resampled, resampled_count);
+
+    // Dynamic rate control: the emulated clock and the audio device
+    // clock drift apart, nudge the ratio to keep the ring at the
+    // target fill level
+    // A fuller ring consumes more input per output sample
+    audio_fill += ((double) ring_buffer_count(&audio_ring) - audio_fill) * 0.05;
+    ratio_delta = (audio_fill - audio_target_fill) / audio_target_fill * audio_max_ratio_delta;
+    if (ratio_delta > audio_max_ratio_delta)
+        ratio_delta = audio_max_ratio_delta;
+    else if (ratio_delta < -audio_max_ratio_delta)
+        ratio_delta = -audio_max_ratio_delta;
+    resampler_set_ratio(audio_resampler, 1.0 + ratio_delta);
+}
+
 // Emulate clocks
-void emulate_clocks(gb_system_t *gb, float *audio_buffer)
+void emulate_clocks(gb_system_t *gb)
 {
     static Uint32 last_ticks = 0;
     static double second_elapsed = 0.0;
     Uint32 ticks = SDL_GetTicks();
-    size_t audio_remaining_clocks;
-    size_t audio_clock_delay;
-    size_t lfsr_remaining;
-    size_t lfsr_delay;
     size_t remaining_clocks;
+    size_t clocks;
     double elapsed;
 
     // Initialize last_ticks
     if (last_ticks == 0)
         last_ticks = SDL_GetTicks();
 
+    // Apply the requests from the main thread
+    set_clock_speed((uint32_t) SDL_AtomicGet(&requested_clock_speed));
+    apply_joypad_inputs(gb);
+    if (SDL_AtomicSet(&trace_dump_request, 0) && gb->trace)
+        cpu_trace_dump(NULL, gb);
+
     // Calculate elapsed time since last call to emulate_clocks()
     elapsed = (double) (ticks - last_ticks) / 1000.0;
 
@@ -269,15 +372,14 @@ void emulate_clocks(gb_system_t *gb, float *audio_buffer)
     if ((second_elapsed += elapsed) >= 1.0) {
         second_elapsed = 0.0;
 
-        lcd_win_clock_freq = (double) clocks_per_second / (double) 1000000.0;
-        lcd_win_clock_speed = (double) clocks_per_second / (double) CPU_CLOCK_SPEED * 100.0;
-        lcd_win_framerate = frames_per_second;
+        SDL_AtomicSet(&lcd_win_clocks, (int) clocks_per_second);
+        SDL_AtomicSet(&lcd_win_framerate, (int) frames_per_second);
 
         clocks_per_second = 0;
         frames_per_second = 0;
     }
 
-    if (!pause_emulation) {
+    if (!SDL_AtomicGet(&pause_emulation)) {
         // Calculate how many clocks should be emulated
         // since last frame
         remaining_clocks = elapsed * clock_speed;
@@ -286,53 +388,29 @@ void emulate_clocks(gb_system_t *gb, float *audio_buffer)
         if (clocks_per_second <= clock_speed && clocks_per_second + remaining_clocks > clock_speed)
             remaining_clocks = clock_speed - clocks_per_second;
 
-        // Calculate when to generate an audio sample
-        audio_clock_delay = remaining_clocks / audio_buffer_samples;
-        audio_remaining_clocks = 0;
-
-        // Calculate when to clock LFSR
-        lfsr_remaining = (size_t) (gb->apu.ch4.freq * elapsed);
-        lfsr_delay = (lfsr_remaining > 0) ? (remaining_clocks / lfsr_remaining) : 0;
-        lfsr_remaining = 0;
-
         // Count the clocks we are about to emulate
         clocks_per_second += remaining_clocks;
 
-        // Emulate the clocks
-        for (; remaining_clocks > 0; --remaining_clocks, gb->cycle_nb += 1) {
-            if (cpu_cycle(gb) < 0) {
-                // Emulation should be stopped
-                stop_emulation = true;
+        // Emulate the clocks, stop the emulation if the CPU requested it
+        // With audio, the samples are read after every frame so that the
+        // APU buffer never fills up, whatever the speed and the elapsed time
+        while (remaining_clocks > 0) {
+            clocks = remaining_clocks < LCD_FRAME_CYCLES ? remaining_clocks : LCD_FRAME_CYCLES;
+            if (gb_system_run(clocks, gb) < clocks) {
+                SDL_AtomicSet(&stop_emulation, 1);
                 break;
             }
-            ppu_cycle(gb);
-            serial_cycle(gb);
-
-            if (gb->memory.mbc_clock)
-                (*(gb->memory.mbc_clock))(gb);
-
-            if (audio_buffer) {
-                // Only generate audio samples if an audio_buffer is given
-                if (audio_remaining_clocks > 0) {
-                    audio_remaining_clocks -= 1;
-                } else if (audio_pos < audio_buffer_samples) {
-                    audio_remaining_clocks = audio_clock_delay;
-                    audio_buffer[audio_pos++] = (float) (apu_generate_sample(audio_time(), gb) * audio_volume);
-                }
-            }
-
-            if (lfsr_remaining > 0) {
-                lfsr_remaining -= 1;
-            } else if (lfsr_delay > 0) {
-                lfsr_remaining = lfsr_delay;
-                apu_lfsr_clock(gb);
-            }
+            if (audio_resampler)
+                emulator_audio_drain(gb);
+            remaining_clocks -= clocks;
         }
     }
 
     last_ticks = ticks;
 }
 
+// The debugging views read the emulator state while it is running on the
+// emulation thread, the values can be from different cycles
 void update_windows(gb_system_t *gb)
 {
     update_emulator_window_title(gb);
@@ -349,7 +427,7 @@ void lcd_event(SDL_Event *e, gb_system_t *gb)
         case SDL_WINDOWEVENT:
             switch (e->window.event) {
                 case SDL_WINDOWEVENT_CLOSE:
-                    stop_emulation = true;
+                    SDL_AtomicSet(&stop_emulation, 1);
                     break;
 
                 case SDL_WINDOWEVENT_RESIZED:
@@ -362,26 +440,24 @@ void lcd_event(SDL_Event *e, gb_system_t *gb)
 
         case SDL_KEYDOWN:
             if (e->key.keysym.scancode == emu_keymap.emu_exit) {
-                stop_emulation = true;
+                SDL_AtomicSet(&stop_emulation, 1);
             } else if (e->key.keysym.scancode == emu_keymap.emu_pause) {
-                pause_emulation = !pause_emulation;
+                SDL_AtomicSet(&pause_emulation, !SDL_AtomicGet(&pause_emulation));
                 update_windows(gb);
             } else if (e->key.keysym.scancode == emu_keymap.emu_speed) {
-                set_clock_speed(CPU_CLOCK_SPEED * 4);
+                request_clock_speed(CPU_CLOCK_SPEED * 4);
                 audio_scale(0.2);
             } else if (e->key.keysym.scancode == emu_keymap.emu_slow) {
-                set_clock_speed(CPU_CLOCK_SPEED / 4);
+                request_clock_speed(CPU_CLOCK_SPEED / 4);
                 audio_scale(0.2);
             } else if (e->key.keysym.scancode == emu_keymap.emu_vol_up) {
                 if (!audio_scaled) {
-                    if ((audio_volume += audio_volume_step) >= 1.0)
-                        audio_volume = 1.0;
+                    audio_step_volume(audio_volume_step);
                     update_windows(gb);
                 }
             } else if (e->key.keysym.scancode == emu_keymap.emu_vol_down) {
                 if (!audio_scaled) {
-                    if ((audio_volume -= audio_volume_step) <= 0.001)
-                        audio_volume = 0.0;
+                    audio_step_volume(-audio_volume_step);
                     update_windows(gb);
                 }
             } else if (e->key.keysym.scancode == emu_keymap.emu_cpu_view) {
@@ -396,17 +472,19 @@ void lcd_event(SDL_Event *e, gb_system_t *gb)
                 } else {
                     mmu_view_open();
                 }
+            } else if (e->key.keysym.scancode == emu_keymap.emu_trace_dump) {
+                SDL_AtomicSet(&trace_dump_request, 1);
             } else {
-                handle_joypad_input(e, true, gb);
+                handle_joypad_input(e, true);
             }
             break;
 
         case SDL_KEYUP:
             if (e->key.keysym.scancode == emu_keymap.emu_speed || e->key.keysym.scancode == emu_keymap.emu_slow) {
-                set_clock_speed(CPU_CLOCK_SPEED);
+                request_clock_speed(CPU_CLOCK_SPEED);
                 audio_unscale();
             } else {
-                handle_joypad_input(e, false, gb);
+                handle_joypad_input(e, false);
             }
             break;
 
@@ -421,7 +499,7 @@ void handle_events(gb_system_t *gb)
 
     while (SDL_PollEvent(&e)) {
         if (e.type == SDL_QUIT) {
-            stop_emulation = true;
+            SDL_AtomicSet(&stop_emulation, 1);
             return;
         }
 
@@ -440,72 +518,106 @@ int emulator_loop(gb_system_t *gb)
     Uint32 frame_start;
     Uint32 frame_ticks;
 
-    while (!stop_emulation) {
+    while (!SDL_AtomicGet(&stop_emulation)) {
         frame_start = SDL_GetTicks();
 
-        emulate_clocks(gb, NULL);
-        handle_events(gb);
-        update_windows(gb);
+        emulate_clocks(gb);
 
         // Calculate elapsed time in ms for a single frame
         frame_ticks = SDL_GetTicks() - frame_start;
 
-        // If emulation is paused, render frames manually
-        if (pause_emulation)
-            render_frame(gb);
-
         // If a single frame takes less time than frame_ms, add a delay
         // to reach the target_framerate
-        if (!stop_emulation && frame_ticks < target_framerate_ticks)
+        if (!SDL_AtomicGet(&stop_emulation) && frame_ticks < target_framerate_ticks)
             SDL_Delay(target_framerate_ticks - frame_ticks);
     }
 
     return 0;
 }
 
-// Main emulator loop (timed using audio queue)
+// Audio device callback, pops the samples of the emulation thread
+// On underrun the last sample decays to silence instead of popping
+static void audio_callback(__attribute__((unused)) void *userdata, Uint8 *stream, int len)
+{
+    static float last_sample = 0.0f;
+    float *out = (float *) stream;
+    size_t count = len / sizeof(float);
+    size_t popped = ring_buffer_pop(&audio_ring, out, count);
+    const float volume = (float) SDL_AtomicGet(&audio_volume) / 1000.0f;
+
+    for (size_t i = 0; i < popped; ++i)
+        out[i] *= volume;
+    if (popped > 0)
+        last_sample = out[popped - 1];
+
+    for (size_t i = popped; i < count; ++i) {
+        last_sample *= 0.995f;
+        out[i] = last_sample;
+    }
+}
+
+// Main emulator loop (timed using elapsed time, the audio is kept in sync
+// by adjusting the resampling ratio)
 int emulator_audio_loop(gb_system_t *gb)
 {
-    float *audio_buffer = xalloc(audio_buffer_size);
-    Uint32 audio_pending, audio_delay;
-    Uint32 next_frame = 0;
+    Uint32 frame_start;
+    Uint32 frame_ticks;
 
+    audio_resampled = xalloc(APU_SAMPLES_SIZE * sizeof(float));
+    audio_resampler = xalloc(sizeof(resampler_t));
+    audio_fill = audio_target_fill;
+    resampler_init(audio_resampler, APU_NATIVE_RATE, audio_sample_rate);
     SDL_PauseAudioDevice(audio_devid, 0);
-    while (!stop_emulation) {
-        audio_pos = 0;
-        emulate_clocks(gb, audio_buffer);
-        handle_events(gb);
-        update_windows(gb);
+    while (!SDL_AtomicGet(&stop_emulation)) {
+        frame_start = SDL_GetTicks();
 
-        if (pause_emulation) {
-            // Mute the audio when paused
-            for (int i = 0; i < audio_buffer_samples; ++i)
-                audio_buffer[i] = 0;
+        // The samples are read by emulate_clocks()
+        emulate_clocks(gb);
 
-            // If emulation is paused, render frames manually
-            if (SDL_GetTicks() >= next_frame) {
-                next_frame = SDL_GetTicks() + target_framerate_ticks;
-                render_frame(gb);
-            }
-        } else {
-            // Fill any remaining samples
-            while (audio_pos < audio_buffer_samples)
-                audio_buffer[audio_pos++] = (float) (apu_generate_sample(audio_time(), gb) * audio_volume);
-        }
-
-        // Wait for the queue to be empty before queuing more samples
-        while ((audio_pending = SDL_GetQueuedAudioSize(audio_devid)) > 0) {
-            audio_delay = (audio_sample_duration_ms * (audio_pending / sizeof(float))) / 4;
-            SDL_Delay(audio_delay);
-            handle_events(gb);
-        }
-        SDL_QueueAudio(audio_devid, audio_buffer, audio_buffer_size);
+        frame_ticks = SDL_GetTicks() - frame_start;
+        if (!SDL_AtomicGet(&stop_emulation) && frame_ticks < target_framerate_ticks)
+            SDL_Delay(target_framerate_ticks - frame_ticks);
     }
 
-    free(audio_buffer);
+    free(audio_resampler);
+    free(audio_resampled);
+    audio_resampler = NULL;
+    audio_resampled = NULL;
     return 0;
 }
 
+// Emulation thread
+static int emulation_thread(void *data)
+{
+    gb_system_t *gb = (gb_system_t *) data;
+
+    if (audio_devid) {
+        return emulator_audio_loop(gb);
+    } else {
+        return emulator_loop(gb);
+    }
+}
+
+// Presentation loop (main thread), handles the events and renders the
+// latest frame without ever waiting for the emulation thread
+void present_loop(gb_system_t *gb)
+{
+    Uint32 frame_start;
+    Uint32 frame_ticks;
+
+    while (!SDL_AtomicGet(&stop_emulation)) {
+        frame_start = SDL_GetTicks();
+
+        handle_events(gb);
+        update_windows(gb);
+        render_frame();
+
+        frame_ticks = SDL_GetTicks() - frame_start;
+        if (!SDL_AtomicGet(&stop_emulation) && frame_ticks < target_framerate_ticks)
+            SDL_Delay(target_framerate_ticks - frame_ticks);
+    }
+}
+
 // Emulate GameBoy system loaded in *gb
 // Returns < 0 on initialization error
 // Returns 0 on success
@@ -527,11 +639,13 @@ int emulate_gameboy(gb_system_t *gb, bool enable_audio)
             audiospec.format = AUDIO_F32SYS;
             audiospec.channels = 1;
             audiospec.samples = audio_buffer_samples;
-            audiospec.callback = NULL;
-            audiospec.userdata = gb;
+            audiospec.callback = &audio_callback;
+            audiospec.userdata = NULL;
 
+            ring_buffer_init(&audio_ring, sizeof(float), audio_ring_samples);
             if (!(audio_devid = SDL_OpenAudioDevice(NULL, 0, &audiospec, NULL, 0))) {
                 fprintf(stderr, "SDL_OpenAudioDevice: %s\n", SDL_GetError());
+                ring_buffer_free(&audio_ring);
             }
         }
     }
@@ -559,20 +673,37 @@ int emulate_gameboy(gb_system_t *gb, bool enable_audio)
     SetRenderBackgroundColor(lcd_ren);
     SDL_RenderClear(lcd_ren);
     SDL_RenderPresent(lcd_ren);
+
+    lcd_frames = xalloc(sizeof(triple_buffer_t));
+    triple_buffer_init(lcd_frames);
     gb->screen.vblank_callback = &render_framebuffer;
 
+    SDL_AtomicSet(&stop_emulation, 0);
+    SDL_AtomicSet(&pause_emulation, 0);
+    request_clock_speed(clock_speed);
+
     if (gb->memory.mbc_battery)
         mmu_battery_load(gb);
 
     printf("Emulating: %s\n", gb->cartridge.title);
-    if (audio_devid) {
-        apu_initialize(audio_sample_rate, gb);
-        emulator_audio_loop(gb);
-    } else {
-        emulator_loop(gb);
+    if (audio_devid)
+        apu_initialize(gb);
+
+    if (!(emu_thread = SDL_CreateThread(&emulation_thread, "emulation", gb))) {
+        fprintf(stderr, "SDL_CreateThread: %s\n", SDL_GetError());
+        free(lcd_frames);
+        return -1;
     }
+    present_loop(gb);
+    SDL_WaitThread(emu_thread, NULL);
+    emu_thread = NULL;
     printf("Emulation stopped\n");
 
+    if (audio_devid) {
+        SDL_CloseAudioDevice(audio_devid);
+        ring_buffer_free(&audio_ring);
+    }
+
     if (gb->memory.mbc_battery)
         mmu_battery_save(gb);
 
@@ -582,5 +713,6 @@ int emulate_gameboy(gb_system_t *gb, bool enable_audio)
     SDL_DestroyWindow(lcd_win);
     SDL_FreeSurface(screen_surface);
     TTF_CloseFont(lcd_font);
+    free(lcd_frames);
     return 0;
 }
\ No newline at end of file
@@ -40,7 +40,8 @@ struct keymap emu_keymap = {
     .emu_vol_up    = SDL_SCANCODE_7,
     .emu_vol_down  = SDL_SCANCODE_6,
     .emu_cpu_view  = SDL_SCANCODE_1,
-    .emu_mmu_view  = SDL_SCANCODE_2
+    .emu_mmu_view  = SDL_SCANCODE_2,
+    .emu_trace_dump = SDL_SCANCODE_3
 };
 
 struct emu_windows emu_windows[EMU_WINDOWS_SIZE];
\ No newline at end of file
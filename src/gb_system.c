@@ -22,13 +22,20 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "gameboy.h"
 #include "cartridge.h"
 #include "cpu/registers.h"
+#include "cpu/cpu.h"
+#include "cpu/trace.h"
+#include "cpu/profiler.h"
 #include "mmu/mmu.h"
 #include "mmu/rombanks.h"
 #include "mmu/rambanks.h"
 #include "ppu/lcd_regs.h"
+#include "ppu/ppu.h"
 #include "apu/sound_regs.h"
 #include "timer.h"
 #include "joypad.h"
+#include "serial.h"
+#include "link.h"
+#include "scheduler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -193,6 +200,8 @@ int load_rom_from_file(const char *filename, gb_system_t *gb)
 // Reset a gb_system_t to its startup state
 void gb_system_reset(bool enable_bootrom, gb_system_t *gb)
 {
+    scheduler_reset(gb);
+
     if (enable_bootrom) {
         gb->memory.bootrom_reg = 0;
         gb->pc = 0x0;
@@ -256,14 +265,53 @@ void gb_system_reset(bool enable_bootrom, gb_system_t *gb)
 // Destroy gb_system_t and free all allocated memory
 void gb_system_destroy(gb_system_t *gb)
 {
+    link_unplug(gb);
+    cpu_trace_disable(gb);
+    profiler_disable(gb);
     rombank_free(&gb->memory.rom);
     rambank_free(&gb->memory.ram);
     free(gb->memory.mbc_regs);
     free(gb->rom_file);
     free(gb->sav_file);
+    free(gb->apu.stems);
     free(gb);
 }
 
+// Emulate one cycle
+// Returns false if the emulation was stopped by the CPU
+static inline bool gb_system_step(gb_system_t *gb)
+{
+    if (cpu_cycle(gb) < 0)
+        return false;
+    ppu_cycle(gb);
+    serial_cycle(gb);
+    gb->cycle_nb += 1;
+    return true;
+}
+
+// Emulate clocks cycles
+// Returns the number of cycles emulated, it is less than clocks if the
+// emulation was stopped by the CPU
+size_t gb_system_run(size_t clocks, gb_system_t *gb)
+{
+    size_t cycles;
+
+    for (cycles = 0; cycles < clocks && gb_system_step(gb); ++cycles);
+    return cycles;
+}
+
+// Emulate clocks cycles of two GameBoys in lockstep, one cycle at a time
+// A link cable plugged between them is exact to the cycle
+// Returns the number of cycles emulated, it is less than clocks if the
+// emulation of one of them was stopped by the CPU
+size_t gb_system_run_pair(size_t clocks, gb_system_t *gb1, gb_system_t *gb2)
+{
+    size_t cycles;
+
+    for (cycles = 0; cycles < clocks && gb_system_step(gb1) && gb_system_step(gb2); ++cycles);
+    return cycles;
+}
+
 // Allocate and initialize an empty gb_system_t
 gb_system_t *gb_system_create(bool enable_bootrom)
 {
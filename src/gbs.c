@@ -0,0 +1,202 @@
+/*
+gbs.c
+GBS (GameBoy Sound) music files
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "gbs.h"
+#include "gb_system.h"
+#include "cartridge.h"
+#include "cpu/cpu.h"
+#include "cpu/interrupts.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Player code placed in the first bank of the ROM built around the GBS data
+#define GBS_PLAY_HANDLER_ADDR (0x0070) // Called by the V-Blank/Timer interrupts
+#define GBS_ENTRY_ADDR        (0x0150) // Right after the cartridge header
+
+#define gbs_u16(data, addr) ((uint16_t) ((data)[(addr)] | ((data)[(addr) + 1] << 8)))
+
+// Load a GBS file
+// Returns NULL on error
+gbs_t *gbs_load_file(const char *filename)
+{
+    gbs_t *gbs;
+    byte_t *data;
+    int size;
+
+    if (!(data = load_file(filename, &size)))
+        return NULL;
+
+    if (size <= GBS_HEADER_SIZE || memcmp(data, "GBS", 3) || data[3] != 1) {
+        logger(LOG_ERROR, "gbs_load_file: %s: Not a GBS version 1 file", filename);
+        free(data);
+        return NULL;
+    }
+
+    gbs = xzalloc(sizeof(gbs_t));
+    gbs->songs = data[0x04];
+    gbs->first_song = data[0x05];
+    gbs->load_addr = gbs_u16(data, 0x06);
+    gbs->init_addr = gbs_u16(data, 0x08);
+    gbs->play_addr = gbs_u16(data, 0x0A);
+    gbs->sp = gbs_u16(data, 0x0C);
+    gbs->tma = data[0x0E];
+    gbs->tac = data[0x0F];
+    memcpy(gbs->title, &data[0x10], 32);
+    memcpy(gbs->author, &data[0x30], 32);
+    memcpy(gbs->copyright, &data[0x50], 32);
+
+    gbs->data_size = size - GBS_HEADER_SIZE;
+    gbs->data = xalloc(gbs->data_size);
+    memcpy(gbs->data, &data[GBS_HEADER_SIZE], gbs->data_size);
+    free(data);
+
+    if (gbs->load_addr < GBS_MIN_LOAD_ADDR || gbs->load_addr >= 0x8000) {
+        logger(LOG_ERROR, "gbs_load_file: %s: Invalid load address $%04X", filename, gbs->load_addr);
+        gbs_destroy(gbs);
+        return NULL;
+    }
+    if (gbs->load_addr + gbs->data_size > GBS_MAX_ROM_BANKS * ROM_BANK_SIZE) {
+        logger(LOG_ERROR, "gbs_load_file: %s: Too much data (%zu bytes)", filename, gbs->data_size);
+        gbs_destroy(gbs);
+        return NULL;
+    }
+    return gbs;
+}
+
+void gbs_destroy(gbs_t *gbs)
+{
+    free(gbs->data);
+    free(gbs);
+}
+
+// Write the player code in the first bank of *rom
+// The RST vectors jump to the load address like on the original player,
+// the interrupt vectors call the play routine
+static void gbs_write_player(const gbs_t *gbs, const byte_t song, byte_t *rom)
+{
+    const bool timer = gbs->tac & 0x04;
+    byte_t *code;
+
+    for (uint16_t rst = 0x00; rst <= 0x38; rst += 0x08) {
+        rom[rst] = 0xC3; // JP load_addr + rst
+        rom[rst + 1] = (gbs->load_addr + rst) & 0xFF;
+        rom[rst + 2] = (gbs->load_addr + rst) >> 8;
+    }
+
+    // V-Blank and Timer interrupts: JP play handler
+    for (uint16_t vec = 0x40; vec <= 0x50; vec += 0x10) {
+        rom[vec] = 0xC3;
+        rom[vec + 1] = GBS_PLAY_HANDLER_ADDR & 0xFF;
+        rom[vec + 2] = GBS_PLAY_HANDLER_ADDR >> 8;
+    }
+
+    // Play handler: CALL play_addr; RETI
+    code = &rom[GBS_PLAY_HANDLER_ADDR];
+    *code++ = 0xCD; *code++ = gbs->play_addr & 0xFF; *code++ = gbs->play_addr >> 8;
+    *code++ = 0xD9;
+
+    // Entry point: NOP; JP GBS_ENTRY_ADDR
+    rom[CARTRIDGE_HEADER_LADDR] = 0x00;
+    rom[CARTRIDGE_HEADER_LADDR + 1] = 0xC3;
+    rom[CARTRIDGE_HEADER_LADDR + 2] = GBS_ENTRY_ADDR & 0xFF;
+    rom[CARTRIDGE_HEADER_LADDR + 3] = GBS_ENTRY_ADDR >> 8;
+
+    code = &rom[GBS_ENTRY_ADDR];
+    *code++ = 0xF3;                                                         // DI
+    *code++ = 0x31; *code++ = gbs->sp & 0xFF; *code++ = gbs->sp >> 8;       // LD SP, sp
+    *code++ = 0x3E; *code++ = 0x0A;                                         // LD A, $0A
+    *code++ = 0xEA; *code++ = 0x00; *code++ = 0x00;                         // LD ($0000), A (RAM on)
+    *code++ = 0x3E; *code++ = 0x01;                                         // LD A, $01
+    *code++ = 0xEA; *code++ = 0x00; *code++ = 0x20;                         // LD ($2000), A (bank 1)
+    *code++ = 0x3E; *code++ = gbs->tma;                                     // LD A, tma
+    *code++ = 0xE0; *code++ = 0x06;                                         // LDH (TMA), A
+    *code++ = 0x3E; *code++ = gbs->tac & 0x07;                              // LD A, tac
+    *code++ = 0xE0; *code++ = 0x07;                                         // LDH (TAC), A
+    *code++ = 0x3E; *code++ = song;                                         // LD A, song
+    *code++ = 0xCD; *code++ = gbs->init_addr & 0xFF; *code++ = gbs->init_addr >> 8; // CALL init
+    *code++ = 0xAF;                                                         // XOR A
+    *code++ = 0xE0; *code++ = 0x0F;                                         // LDH (IF), A
+    *code++ = 0x3E; *code++ = 1 << (timer ? INT_TIMER_BIT : INT_VBLANK_BIT); // LD A, ie
+    *code++ = 0xE0; *code++ = 0xFF;                                         // LDH (IE), A
+    *code++ = 0xFB;                                                         // EI
+    *code++ = 0x76;                                                         // HALT
+    *code++ = 0x18; *code++ = 0xFD;                                         // JR HALT
+}
+
+// Write a cartridge header for an MBC5 cartridge with 8 KiB of RAM
+// MBC5 takes the whole bank number written to $2000 (MBC1 only keeps 5 bits)
+static void gbs_write_header(const gbs_t *gbs, const byte_t rom_size_code, byte_t *rom)
+{
+    const size_t title_len = strnlen(gbs->title, CR_CGB_FLAG_ADDR - CR_TITLE_ADDR);
+
+    memcpy(&rom[CR_LOGO_ADDR], nintendo_logo, sizeof(nintendo_logo));
+    memcpy(&rom[CR_TITLE_ADDR], gbs->title, title_len);
+    rom[CR_MBC_TYPE_ADDR] = 0x1A; // MBC5+RAM
+    rom[CR_ROM_SIZE_ADDR] = rom_size_code;
+    rom[CR_RAM_SIZE_ADDR] = 0x02; // 8 KiB
+    rom[CR_HEADER_CHECKSUM_ADDR] = compute_header_checksum(rom);
+}
+
+// Create a system playing song (0-based) of *gbs
+// The GBS data is placed at its load address in a ROM image, with a small
+// player in front of it
+// Returns NULL on error
+gb_system_t *gbs_create_system(const gbs_t *gbs, const byte_t song)
+{
+    const size_t data_end = gbs->load_addr + gbs->data_size;
+    gb_system_t *gb;
+    byte_t rom_size_code = 0;
+    size_t rom_size;
+    byte_t *rom;
+
+    while ((rom_size = (size_t) (ROM_BANK_SIZE * 2) << rom_size_code) < data_end)
+        rom_size_code += 1;
+
+    rom = xzalloc(rom_size);
+    memcpy(&rom[gbs->load_addr], gbs->data, gbs->data_size);
+    gbs_write_player(gbs, song, rom);
+    gbs_write_header(gbs, rom_size_code, rom);
+
+    gb = gb_system_create(false);
+    if (load_rom(rom, rom_size, gb) < 0) {
+        gb_system_destroy(gb);
+        gb = NULL;
+    }
+    free(rom);
+    return gb;
+}
+
+// Emulate clocks cycles of the CPU only, the LCD is off
+// The V-Blank interrupt is requested every frame for the play routine
+// Returns the number of cycles emulated, it is less than clocks if the
+// emulation was stopped by the CPU
+size_t gbs_run(size_t clocks, gb_system_t *gb)
+{
+    size_t cycles;
+
+    for (cycles = 0; cycles < clocks; ++cycles, gb->cycle_nb += 1) {
+        if (cpu_cycle(gb) < 0)
+            break;
+        if ((gb->cycle_nb % LCD_FRAME_CYCLES) == LCD_FRAME_CYCLES - 1)
+            cpu_int_flag_set(INT_VBLANK_BIT, gb);
+    }
+    return cycles;
+}
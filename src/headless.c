@@ -0,0 +1,180 @@
+/*
+headless.c
+Emulate without a window or audio device, as fast as possible
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "headless.h"
+#include "gb_system.h"
+#include "audio_capture.h"
+#include "apu/apu.h"
+#include "apu/resampler.h"
+#include "mmu/mmu.h"
+#include "serial_sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HEADLESS_STREAMS (5) // Mixed output and the four channels
+
+// An audio stream resampled from the APU and written to a file
+struct headless_stream {
+    resampler_t resampler;
+    audio_capture_t *capture;
+};
+
+// Returns a monotonic time in seconds
+static double headless_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+// Returns filename with ".tag" inserted before its extension
+char *headless_filename(const char *filename, const char *tag)
+{
+    const char *ext = strrchr(filename, '.');
+    const char *sep = strrchr(filename, '/');
+    size_t base_len = (ext && (!sep || ext > sep)) ? (size_t) (ext - filename) : strlen(filename);
+    char *tagged = xalloc(strlen(filename) + strlen(tag) + 2);
+
+    memcpy(tagged, filename, base_len);
+    sprintf(tagged + base_len, ".%s%s", tag, filename + base_len);
+    return tagged;
+}
+
+// Open the capture files, returns the number of streams opened or -1 on
+// error
+static int headless_open_streams(struct headless_stream *streams,
+                                 const struct headless_options *opts)
+{
+    int count = opts->audio_stems ? HEADLESS_STREAMS : 1;
+    char *filename;
+    char tag[8];
+
+    for (int i = 0; i < count; ++i) {
+        snprintf(tag, sizeof(tag), "ch%d", i);
+        filename = (i == 0) ? xstrdup(opts->audio_file) : headless_filename(opts->audio_file, tag);
+        resampler_init(&streams[i].resampler, APU_NATIVE_RATE, HEADLESS_AUDIO_RATE);
+        streams[i].capture = audio_capture_open(filename, HEADLESS_AUDIO_RATE);
+        free(filename);
+
+        if (!streams[i].capture) {
+            while (--i >= 0)
+                audio_capture_close(streams[i].capture);
+            return -1;
+        }
+    }
+    return count;
+}
+
+// Resample and queue the samples generated by the APU
+static void headless_write_streams(struct headless_stream *streams,
+                                   const int count,
+                                   float *resampled,
+                                   gb_system_t *gb)
+{
+    const float *in;
+    size_t n;
+
+    apu_sync(gb);
+    for (int i = 0; i < count; ++i) {
+        in = (i == 0) ? gb->apu.samples : gb->apu.stems->samples[i - 1];
+        n = resampler_process(&streams[i].resampler, in, gb->apu.samples_count,
+                              resampled, APU_SAMPLES_SIZE);
+        audio_capture_write(streams[i].capture, resampled, n);
+    }
+    gb->apu.samples_count = 0;
+}
+
+// Emulate opts->seconds of GameBoy time without presenting anything
+// Returns < 0 on initialization error
+// Returns 0 on success
+// Returns > 0 on error during emulation
+int emulate_headless(const struct headless_options *opts, gb_system_t *gb)
+{
+    const size_t total = (size_t) (opts->seconds * CPU_CLOCK_SPEED);
+    size_t (*run)(size_t, gb_system_t *) = opts->run ? opts->run : &gb_system_run;
+    struct headless_stream *streams = NULL;
+    float *resampled = NULL;
+    int streams_count = 0;
+    size_t emulated = 0;
+    size_t clocks, ran;
+    double start, elapsed;
+    int ret = 0;
+
+    if (opts->audio_file) {
+        apu_initialize(gb);
+        if (opts->audio_stems)
+            apu_enable_stems(gb);
+
+        streams = xalloc(sizeof(struct headless_stream) * HEADLESS_STREAMS);
+        resampled = xalloc(sizeof(float) * APU_SAMPLES_SIZE);
+        if ((streams_count = headless_open_streams(streams, opts)) < 0) {
+            free(resampled);
+            free(streams);
+            return -1;
+        }
+    }
+
+    if (gb->memory.mbc_battery)
+        mmu_battery_load(gb);
+
+    printf("Emulating: %s (headless, %.2f seconds)\n", gb->cartridge.title, opts->seconds);
+    start = headless_now();
+    while (emulated < total) {
+        // Run one frame at a time so that the APU samples never overflow
+        clocks = total - emulated;
+        if (clocks > LCD_FRAME_CYCLES)
+            clocks = LCD_FRAME_CYCLES;
+
+        ran = (*run)(clocks, gb);
+        emulated += ran;
+        if (streams_count > 0)
+            headless_write_streams(streams, streams_count, resampled, gb);
+
+        if (ran < clocks) {
+            ret = 1;
+            break;
+        }
+        if (gb->serial.sink && gb->serial.sink->matched >= 0) {
+            printf("Serial output matched '%s'\n",
+                gb->serial.sink->patterns[gb->serial.sink->matched]);
+            break;
+        }
+    }
+    elapsed = headless_now() - start;
+
+    for (int i = 0; i < streams_count; ++i) {
+        if (audio_capture_close(streams[i].capture) < 0)
+            ret = 1;
+    }
+    free(resampled);
+    free(streams);
+
+    if (gb->memory.mbc_battery)
+        mmu_battery_save(gb);
+
+    printf("Emulated %.2f seconds in %.2f seconds (%.1fx)\n",
+        (double) emulated / CPU_CLOCK_SPEED, elapsed,
+        (double) emulated / CPU_CLOCK_SPEED / (elapsed > 0.0 ? elapsed : 1.0));
+    return ret;
+}
@@ -0,0 +1,314 @@
+/*
+link.c
+Link cable between two emulators
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "link.h"
+#include "serial.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Messages are packed as type (8 bits), sequence # (16 bits) and value
+#define LINK_MSG_DATA  (0x1) // Byte shifted out by the side driving the clock
+#define LINK_MSG_REPLY (0x2) // Byte shifted out by the other side in return
+#define LINK_MSG(type, seq, value) \
+    (((uint32_t) (type) << 24) | ((uint32_t) (seq) << 8) | (uint32_t) (value))
+#define LINK_MSG_TYPE(msg)  ((msg) >> 24)
+#define LINK_MSG_SEQ(msg)   ((uint16_t) ((msg) >> 8))
+#define LINK_MSG_VALUE(msg) ((byte_t) (msg))
+
+// Returns a monotonic time in milliseconds
+static long link_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Queue a message, returns false if the channel is full
+static bool link_channel_push(struct link_channel *ch, uint32_t msg)
+{
+    const size_t head = atomic_load_explicit(&ch->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&ch->tail, memory_order_acquire);
+
+    if (head - tail >= LINK_CHANNEL_SIZE)
+        return false;
+    ch->msgs[head & (LINK_CHANNEL_SIZE - 1)] = msg;
+    atomic_store_explicit(&ch->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Pop a message, returns false if the channel is empty
+static bool link_channel_pop(struct link_channel *ch, uint32_t *msg)
+{
+    const size_t tail = atomic_load_explicit(&ch->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&ch->head, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+    *msg = ch->msgs[tail & (LINK_CHANNEL_SIZE - 1)];
+    atomic_store_explicit(&ch->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Plug a link cable between two GameBoys emulated in the same thread
+// They must be emulated in lockstep (see gb_system_run_pair())
+void link_plug_local(gb_system_t *gb1, gb_system_t *gb2)
+{
+    link_unplug(gb1);
+    link_unplug(gb2);
+
+    gb1->serial.link = xzalloc(sizeof(link_t));
+    gb1->serial.link->type = LINK_LOCAL;
+    gb1->serial.link->peer = gb2;
+    gb2->serial.link = xzalloc(sizeof(link_t));
+    gb2->serial.link->type = LINK_LOCAL;
+    gb2->serial.link->peer = gb1;
+}
+
+// Open the shared memory object, the first process to open it creates it
+// Returns NULL on error
+static struct link_shm *link_shm_open(link_t *link)
+{
+    const long deadline = link_now_ms() + LINK_TIMEOUT_MS;
+    struct link_shm *shm;
+    struct stat st;
+    int fd;
+
+    if ((fd = shm_open(link->shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR)) >= 0) {
+        link->side = 0;
+        if (ftruncate(fd, sizeof(struct link_shm)) < 0) {
+            logger(LOG_ERROR, "ftruncate(): %s: %s", link->shm_name, strerror(errno));
+            close(fd);
+            shm_unlink(link->shm_name);
+            return NULL;
+        }
+    } else if (errno == EEXIST && (fd = shm_open(link->shm_name, O_RDWR, 0)) >= 0) {
+        // Wait for the other process to finish creating it
+        link->side = 1;
+        while (fstat(fd, &st) == 0 && (size_t) st.st_size < sizeof(struct link_shm)) {
+            if (link_now_ms() >= deadline) {
+                logger(LOG_ERROR, "link: %s: Not a link cable", link->shm_name);
+                close(fd);
+                return NULL;
+            }
+            usleep(1000);
+        }
+    } else {
+        logger(LOG_ERROR, "shm_open(): %s: %s", link->shm_name, strerror(errno));
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(struct link_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        logger(LOG_ERROR, "mmap(): %s: %s", link->shm_name, strerror(errno));
+        if (link->side == 0)
+            shm_unlink(link->shm_name);
+        return NULL;
+    }
+    return shm;
+}
+
+// Plug a link cable to another emulator process that uses the same name
+// Returns false on error
+bool link_plug_shm(const char *name, gb_system_t *gb)
+{
+    link_t *link = xzalloc(sizeof(link_t));
+    long deadline;
+    int sides;
+
+    link->type = LINK_SHM;
+    link->shm_name = xalloc(strlen(name) + 2);
+    sprintf(link->shm_name, "%s%s", name[0] == '/' ? "" : "/", name);
+    if (!(link->shm = link_shm_open(link))) {
+        free(link->shm_name);
+        free(link);
+        return false;
+    }
+
+    // The object is zero-filled when created, both sides count themselves in
+    // as the other side can map it before this one does
+    sides = atomic_fetch_add(&link->shm->sides, 1);
+    if (link->side == 0) {
+        // Wait for the other side so that both start emulating together
+        logger(LOG_INFO, "link: %s: Waiting for the other side", link->shm_name);
+        deadline = link_now_ms() + LINK_CONNECT_MS;
+        while (atomic_load(&link->shm->sides) < 2) {
+            if (link_now_ms() >= deadline) {
+                logger(LOG_ERROR, "link: %s: The other side did not connect", link->shm_name);
+                shm_unlink(link->shm_name);
+                munmap(link->shm, sizeof(struct link_shm));
+                free(link->shm_name);
+                free(link);
+                return false;
+            }
+            usleep(1000);
+        }
+        logger(LOG_INFO, "link: %s: Connected", link->shm_name);
+    } else {
+        if (sides >= 2) {
+            logger(LOG_ERROR, "link: %s: Already in use", link->shm_name);
+            munmap(link->shm, sizeof(struct link_shm));
+            free(link->shm_name);
+            free(link);
+            return false;
+        }
+
+        // Both sides are mapped, the name is no longer needed
+        shm_unlink(link->shm_name);
+        logger(LOG_INFO, "link: %s: Connected", link->shm_name);
+    }
+
+    link_unplug(gb);
+    gb->serial.link = link;
+    return true;
+}
+
+// Unplug the link cable (if any)
+void link_unplug(gb_system_t *gb)
+{
+    link_t *link = gb->serial.link;
+
+    if (!link)
+        return;
+
+    switch (link->type) {
+        case LINK_LOCAL:
+            free(link->peer->serial.link);
+            link->peer->serial.link = NULL;
+            break;
+
+        case LINK_SHM:
+            munmap(link->shm, sizeof(struct link_shm));
+            free(link->shm_name);
+            break;
+    }
+    free(link);
+    gb->serial.link = NULL;
+}
+
+// Claim the transfer seq started by side, returns false if the other side
+// already claimed it (or it is not pending anymore)
+static bool link_claim(link_t *link, int side, uint16_t seq)
+{
+    unsigned int expected = seq;
+
+    return atomic_compare_exchange_strong(&link->shm->pending[side], &expected, 0);
+}
+
+// Answer a transfer started by the other process with value
+// Returns false if the message was stale (the transfer was cancelled)
+static bool link_answer(link_t *link, uint32_t msg, byte_t value)
+{
+    if (!link_claim(link, link->side ^ 1, LINK_MSG_SEQ(msg)))
+        return false;
+    if (!link_channel_push(&link->shm->channels[link->side],
+                           LINK_MSG(LINK_MSG_REPLY, LINK_MSG_SEQ(msg), value)))
+        logger(LOG_WARN, "link: Channel is full");
+    return true;
+}
+
+// Called when a transfer clocked by this side starts
+void link_transfer_start(byte_t out, gb_system_t *gb)
+{
+    link_t *link = gb->serial.link;
+
+    if (link->type == LINK_SHM) {
+        if ((link->seq += 1) == 0)
+            link->seq = 1;
+        link->deadline = gb->cycle_nb + LINK_TIMEOUT_CLOCKS;
+        atomic_store(&link->shm->pending[link->side], link->seq);
+        if (!link_channel_push(&link->shm->channels[link->side], LINK_MSG(LINK_MSG_DATA, link->seq, out)))
+            logger(LOG_WARN, "link: Channel is full");
+    }
+}
+
+// Called when a transfer clocked by this side ends, out is sent to the
+// other side if it is waiting for a transfer on its external clock
+// With another process the reply may not be there yet, this returns false
+// and must be called again later (the emulation is never blocked)
+// Returns true and sets in to the byte shifted in (0xFF if the other side did
+// not answer) when the transfer is done
+bool link_transfer_end(byte_t out, byte_t *in, gb_system_t *gb)
+{
+    link_t *link = gb->serial.link;
+    uint32_t msg;
+
+    if (link->type == LINK_LOCAL) {
+        if (   !link->peer->serial.sc.transfer_start
+            ||  link->peer->serial.sc.internal_clock)
+        {
+            *in = 0xFF;
+        } else {
+            *in = link->peer->serial.sb;
+            serial_transfer_end(out, link->peer);
+        }
+        return true;
+    }
+
+    while (link_channel_pop(&link->shm->channels[link->side ^ 1], &msg)) {
+        if (LINK_MSG_TYPE(msg) == LINK_MSG_REPLY && LINK_MSG_SEQ(msg) == link->seq) {
+            *in = LINK_MSG_VALUE(msg);
+            return true;
+        }
+
+        // Both sides are clocking a transfer, none of them drives the data
+        // line of the other
+        if (LINK_MSG_TYPE(msg) == LINK_MSG_DATA)
+            link_answer(link, msg, 0xFF);
+    }
+
+    // Once cancelled the other side drops the transfer, if it claimed it
+    // first its reply is on the way
+    if (gb->cycle_nb >= link->deadline && link_claim(link, link->side, link->seq)) {
+        logger(LOG_WARN, "link: Transfer timed out");
+        *in = 0xFF;
+        return true;
+    }
+    return false;
+}
+
+// Called while a transfer on the external clock is pending
+// Completes it if the other process started one
+void link_poll(gb_system_t *gb)
+{
+    link_t *link = gb->serial.link;
+    uint32_t msg;
+
+    if (link->type != LINK_SHM)
+        return;
+
+    // Replies to aborted transfers and transfers that the other side
+    // cancelled are dropped
+    while (link_channel_pop(&link->shm->channels[link->side ^ 1], &msg)) {
+        if (LINK_MSG_TYPE(msg) == LINK_MSG_DATA && link_answer(link, msg, gb->serial.sb)) {
+            serial_transfer_end(LINK_MSG_VALUE(msg), gb);
+            return;
+        }
+    }
+}
@@ -18,11 +18,39 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "logger.h"
+#include "xalloc.h"
+#include "ring_buffer.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 
-static loglevel_t logger_level = LOG_WARN;
+#define LOGGER_MESSAGE_SIZE (384)     // Formatted message of a record
+#define LOGGER_RING_SIZE    (512)     // Records buffered per thread
+#define LOGGER_BATCH_SIZE   (32)      // Records popped at once by the writer
+#define LOGGER_IDLE_NS      (5000000) // Writer sleep when there is nothing to log
+
+// Messages are formatted by the thread that logs them into fixed-size
+// records and pushed to a ring owned by that thread, the writer thread pops
+// them and writes them in batches
+// When a ring is full the records are dropped instead of waiting
+struct logger_record {
+    loglevel_t level;
+    int instance;
+    char message[LOGGER_MESSAGE_SIZE];
+};
+
+struct logger_ring {
+    ring_buffer_t records;
+    atomic_size_t dropped;      // Records dropped because the ring was full
+    atomic_bool closed;         // The thread exited, free it once empty
+    struct logger_ring *next;
+};
+
+static atomic_int logger_level = LOG_WARN;
 static const char *loglevel_names[] = {
     "All",
     "Debug",
@@ -33,31 +61,201 @@ static const char *loglevel_names[] = {
     NULL
 };
 
+static _Thread_local int logger_instance = -1;
+static _Thread_local struct logger_ring *logger_thread_ring = NULL;
+
+static pthread_once_t logger_once = PTHREAD_ONCE_INIT;
+static pthread_key_t logger_ring_key;
+static pthread_mutex_t logger_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct logger_ring *logger_rings = NULL;
+static pthread_t logger_writer;
+static atomic_bool logger_running = false;
+static atomic_bool logger_stopping = false;
+static atomic_size_t logger_passes = 0; // Passes completed by the writer
+
 // Change the logging level
 // Returns false on error
 bool logger_set_level_name(const char *level_name)
 {
     for (loglevel_t i = 0; loglevel_names[i]; ++i) {
         if (!strcasecmp(level_name, loglevel_names[i])) {
-            logger_level = i;
+            atomic_store(&logger_level, i);
             return true;
         }
     }
     return false;
 }
 
+// Tag the messages logged by the calling thread with an instance id
+// (-1 to disable)
+void logger_set_instance(int id)
+{
+    logger_instance = id;
+}
+
+// Append a formatted record to buf, returns the new length
+static size_t logger_format(char *buf, size_t len, size_t size,
+    loglevel_t level, int instance, const char *message)
+{
+    int n;
+
+    if (instance >= 0)
+        n = snprintf(buf + len, size - len, "[%s] #%d: %s\n", loglevel_names[level], instance, message);
+    else
+        n = snprintf(buf + len, size - len, "[%s] %s\n", loglevel_names[level], message);
+    return (n < 0 || (size_t) n >= size - len) ? size - 1 : len + n;
+}
+
+// Write the records of all the rings
+// Returns the number of records written
+static size_t logger_drain(void)
+{
+    static char buf[LOGGER_BATCH_SIZE * (LOGGER_MESSAGE_SIZE + 32)];
+    struct logger_record batch[LOGGER_BATCH_SIZE];
+    struct logger_ring **prev, *ring;
+    size_t total = 0;
+    size_t count, len, dropped;
+
+    pthread_mutex_lock(&logger_rings_lock);
+    prev = &logger_rings;
+    while ((ring = *prev)) {
+        while ((count = ring_buffer_pop(&ring->records, batch, LOGGER_BATCH_SIZE)) > 0) {
+            len = 0;
+            for (size_t i = 0; i < count; ++i)
+                len = logger_format(buf, len, sizeof(buf), batch[i].level, batch[i].instance, batch[i].message);
+            fwrite(buf, 1, len, stdout);
+            total += count;
+        }
+
+        if ((dropped = atomic_exchange(&ring->dropped, 0)) > 0) {
+            fprintf(stdout, "[%s] logger: %zu messages dropped\n", loglevel_names[LOG_WARN], dropped);
+            total += 1;
+        }
+
+        if (atomic_load(&ring->closed) && ring_buffer_count(&ring->records) == 0) {
+            *prev = ring->next;
+            ring_buffer_free(&ring->records);
+            free(ring);
+        } else {
+            prev = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&logger_rings_lock);
+
+    if (total > 0)
+        fflush(stdout);
+    return total;
+}
+
+static void *logger_writer_thread(__attribute__((unused)) void *data)
+{
+    const struct timespec idle = {0, LOGGER_IDLE_NS};
+    bool stopping;
+
+    while (true) {
+        stopping = atomic_load(&logger_stopping);
+        if (logger_drain() == 0) {
+            atomic_fetch_add(&logger_passes, 1);
+            if (stopping)
+                break;
+            nanosleep(&idle, NULL);
+        } else {
+            atomic_fetch_add(&logger_passes, 1);
+        }
+    }
+    return NULL;
+}
+
+// Wait until everything that was logged before the call is written
+void logger_flush(void)
+{
+    const struct timespec wait = {0, LOGGER_IDLE_NS / 5};
+    size_t target;
+
+    if (!atomic_load(&logger_running))
+        return;
+
+    // The pass in progress may have missed the last records
+    target = atomic_load(&logger_passes) + 2;
+    while (atomic_load(&logger_running) && atomic_load(&logger_passes) < target)
+        nanosleep(&wait, NULL);
+}
+
+// Write the remaining records and stop the writer thread
+static void logger_stop(void)
+{
+    if (atomic_load(&logger_running)) {
+        atomic_store(&logger_stopping, true);
+        pthread_join(logger_writer, NULL);
+        atomic_store(&logger_running, false);
+    }
+}
+
+// Called when a thread that logged something exits
+static void logger_ring_release(void *data)
+{
+    atomic_store(&((struct logger_ring *) data)->closed, true);
+}
+
+static void logger_start(void)
+{
+    pthread_key_create(&logger_ring_key, &logger_ring_release);
+    if (pthread_create(&logger_writer, NULL, &logger_writer_thread, NULL) == 0) {
+        atomic_store(&logger_running, true);
+        atexit(&logger_stop);
+    }
+}
+
+// Returns the ring of the calling thread, NULL if the writer is not running
+static struct logger_ring *logger_get_ring(void)
+{
+    struct logger_ring *ring;
+
+    if (logger_thread_ring)
+        return logger_thread_ring;
+
+    pthread_once(&logger_once, &logger_start);
+    if (!atomic_load(&logger_running))
+        return NULL;
+
+    ring = xzalloc(sizeof(struct logger_ring));
+    ring_buffer_init(&ring->records, sizeof(struct logger_record), LOGGER_RING_SIZE);
+    pthread_setspecific(logger_ring_key, ring);
+
+    pthread_mutex_lock(&logger_rings_lock);
+    ring->next = logger_rings;
+    logger_rings = ring;
+    pthread_mutex_unlock(&logger_rings_lock);
+
+    logger_thread_ring = ring;
+    return ring;
+}
+
 // Log something
 void logger(loglevel_t level, const char *format, ...)
 {
-    static char fmt_buf[384];
+    struct logger_record record;
+    struct logger_ring *ring;
+    char line[LOGGER_MESSAGE_SIZE + 32];
+    va_list ap;
+
+    if (level < (loglevel_t) atomic_load_explicit(&logger_level, memory_order_relaxed))
+        return;
 
-    if (level >= logger_level) {
-        va_list ap;
+    record.level = level;
+    record.instance = logger_instance;
+    va_start(ap, format);
+    vsnprintf(record.message, sizeof(record.message), format, ap);
+    va_end(ap);
 
-        va_start(ap, format);
-        vsnprintf(fmt_buf, sizeof(fmt_buf), format, ap);
-        fprintf(stdout, "[%s] %s\n", loglevel_names[level], fmt_buf);
+    if (   (ring = logger_get_ring())
+        && !atomic_load_explicit(&logger_stopping, memory_order_relaxed))
+    {
+        if (ring_buffer_push(&ring->records, &record, 1) == 0)
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    } else {
+        // The writer thread is not running, write it synchronously
+        fwrite(line, 1, logger_format(line, 0, sizeof(line), level, record.instance, record.message), stdout);
         fflush(stdout);
-        va_end(ap);
     }
-}
\ No newline at end of file
+}
@@ -20,13 +20,21 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "logger.h"
 #include "gb_system.h"
 #include "emulator.h"
+#include "headless.h"
+#include "gbs.h"
+#include "link.h"
+#include "serial_sink.h"
 #include "cartridge.h"
 #include "emulator_utils.h"
 #include "mmu/mmu.h"
+#include "cpu/trace.h"
+#include "cpu/profiler.h"
 #include "version.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <getopt.h>
 
 static struct args {
@@ -35,18 +43,38 @@ static struct args {
     char *filename;
     bool filename_alloc;
     bool enable_bootrom;
+    bool pixel_fifo;
+    bool dma_accurate;
+    bool headless;
+    struct headless_options headless_opts;
+    bool gbs;
+    int gbs_track;
+    enum rtc_source rtc_source;
+    int64_t rtc_epoch;
+    char *link_name;
+    char *serial_file;
+    char *serial_patterns[SERIAL_SINK_PATTERNS];
+    int serial_patterns_nb;
+    char *trace_file;
+    char *trace_stream;
+    char *trace_log;
+    char *trace_reference;
+    char *profile_file;
 } args;
 
 void print_usage(const char *cmd)
 {
-    printf("Usage: %s [-d] [-l level] filename\n", cmd);
+    printf("Usage: %s [-dnFAW] [-l level] [-r clock] [-L name] [-S file]\n"
+           "       [-P pattern] [-T file] [-X file] [-D file] [-C file]\n"
+           "       [-p file] [-H seconds] [-w file] [-t track] filename\n", cmd);
 }
 
 void print_help(const char *cmd)
 {
     print_usage(cmd);
     printf("\nDescription:\n");
-    printf("    filename        GameBoy ROM to emulate\n\n");
+    printf("    filename        GameBoy ROM to emulate, or a .gbs music file to\n");
+    printf("                    render with -w\n\n");
     printf("    -h              Show this help message\n");
     printf("    -V              Show the version of the emulator\n\n");
     printf("    -l level        Set logging to level (default: warn)\n");
@@ -54,6 +82,38 @@ void print_help(const char *cmd)
     printf("    -b bootrom      Enable and load DMG bootrom\n");
     printf("    -d              Run in debugging mode\n");
     printf("    -n              Disable audio\n");
+    printf("    -F              Use the pixel FIFO renderer (slower but handles\n");
+    printf("                    mid-scanline register writes)\n");
+    printf("    -A              Emulate OAM DMA timing (the transfer takes 640\n");
+    printf("                    clocks and blocks the CPU bus)\n");
+    printf("    -r clock        Clock driving the cartridge RTC (default: host)\n");
+    printf("                    Options: host, emulated (emulated time only),\n");
+    printf("                    or a UNIX timestamp to start emulated time from\n");
+    printf("    -L name         Plug a link cable to the other emulator running\n");
+    printf("                    with the same name\n");
+    printf("    -S file         Write the bytes sent over the serial port to file\n");
+    printf("                    (- for the standard output)\n");
+    printf("    -P pattern      Stop headless mode when the serial output ends\n");
+    printf("                    with pattern (can be repeated)\n");
+    printf("    -T file         Trace the last %i instructions, the trace is\n", CPU_TRACE_DEFAULT_SIZE);
+    printf("                    written to file on illegal opcodes or when\n");
+    printf("                    pressing 3\n");
+    printf("    -X file         Write the trace of every instruction to file\n");
+    printf("    -D file         Log every instruction to file in the gameboy-doctor\n");
+    printf("                    format (- for the standard output)\n");
+    printf("    -C file         Compare every instruction with a gameboy-doctor log\n");
+    printf("                    and stop at the first divergence\n");
+    printf("                    (with -D or -C, LY always reads $90)\n");
+    printf("    -p file         Profile the guest code, write the call stacks to\n");
+    printf("                    file (folded for flamegraphs) and print the\n");
+    printf("                    hotspots when exiting (needs a PROFILER=1 build)\n\n");
+    printf("    -H seconds      Run headless (no window, no audio device) for\n");
+    printf("                    seconds of emulated time, as fast as possible\n");
+    printf("    -w file         Write the audio to file in headless mode (WAV, or\n");
+    printf("                    32-bit float samples if file ends with .raw)\n");
+    printf("    -W              Also write each channel to file.chN.wav\n");
+    printf("    -t track        Only render this track of a .gbs file (1-based,\n");
+    printf("                    default: all tracks to file.NN.wav)\n");
 }
 
 void print_version(void)
@@ -63,7 +123,8 @@ void print_version(void)
 
 void parse_args(int ac, char **av)
 {
-    const char shortopts[] = "hVl:b:dn";
+    const char shortopts[] = "hVl:b:dnFAr:L:S:P:T:X:D:C:p:H:w:Wt:";
+    char *endptr;
     int opt;
 
     // Default values
@@ -72,6 +133,25 @@ void parse_args(int ac, char **av)
     args.filename = NULL;
     args.filename_alloc = false;
     args.enable_bootrom = false;
+    args.pixel_fifo = false;
+    args.dma_accurate = false;
+    args.headless = false;
+    args.headless_opts.seconds = 0.0;
+    args.headless_opts.audio_file = NULL;
+    args.headless_opts.audio_stems = false;
+    args.headless_opts.run = NULL;
+    args.gbs = false;
+    args.gbs_track = 0;
+    args.rtc_source = RTC_SOURCE_HOST;
+    args.rtc_epoch = 0;
+    args.link_name = NULL;
+    args.serial_file = NULL;
+    args.serial_patterns_nb = 0;
+    args.trace_file = NULL;
+    args.trace_stream = NULL;
+    args.trace_log = NULL;
+    args.trace_reference = NULL;
+    args.profile_file = NULL;
 
     // Optionnal arguments
     while ((opt = getopt(ac, av, shortopts)) >= 0) {
@@ -104,6 +184,99 @@ void parse_args(int ac, char **av)
                 args.no_audio = true;
                 break;
 
+            case 'F':
+                args.pixel_fifo = true;
+                break;
+
+            case 'A':
+                args.dma_accurate = true;
+                break;
+
+            case 'r':
+                if (!strcmp(optarg, "host")) {
+                    args.rtc_source = RTC_SOURCE_HOST;
+                } else if (!strcmp(optarg, "emulated")) {
+                    args.rtc_source = RTC_SOURCE_EMULATED;
+                } else {
+                    args.rtc_source = RTC_SOURCE_FIXED;
+                    args.rtc_epoch = strtoll(optarg, &endptr, 10);
+                    if (*endptr || !*optarg) {
+                        fprintf(stderr, "Invalid RTC clock: '%s'\n", optarg);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                break;
+
+            case 'L':
+                args.link_name = optarg;
+                break;
+
+            case 'S':
+                args.serial_file = optarg;
+                break;
+
+            case 'P':
+                if (args.serial_patterns_nb >= SERIAL_SINK_PATTERNS) {
+                    fprintf(stderr, "Too many serial patterns (max %i)\n", SERIAL_SINK_PATTERNS);
+                    exit(EXIT_FAILURE);
+                }
+                if (!*optarg || strlen(optarg) > SERIAL_SINK_WINDOW) {
+                    fprintf(stderr, "Serial patterns must be 1 to %i bytes long\n", SERIAL_SINK_WINDOW);
+                    exit(EXIT_FAILURE);
+                }
+                args.serial_patterns[args.serial_patterns_nb++] = optarg;
+                break;
+
+            case 'T':
+                args.trace_file = optarg;
+                break;
+
+            case 'X':
+                args.trace_stream = optarg;
+                break;
+
+            case 'D':
+                args.trace_log = optarg;
+                break;
+
+            case 'C':
+                args.trace_reference = optarg;
+                break;
+
+            case 'p':
+#ifdef GB_PROFILER
+                args.profile_file = optarg;
+                break;
+#else
+                fprintf(stderr, "The profiler is not built in (build with PROFILER=1)\n");
+                exit(EXIT_FAILURE);
+#endif
+
+            case 'H':
+                args.headless = true;
+                args.headless_opts.seconds = strtod(optarg, &endptr);
+                if (*endptr || args.headless_opts.seconds <= 0.0) {
+                    fprintf(stderr, "Invalid headless duration: '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'w':
+                args.headless_opts.audio_file = optarg;
+                break;
+
+            case 'W':
+                args.headless_opts.audio_stems = true;
+                break;
+
+            case 't':
+                args.gbs_track = strtol(optarg, &endptr, 10);
+                if (*endptr || args.gbs_track <= 0) {
+                    fprintf(stderr, "Invalid track: '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
             default: exit(EXIT_FAILURE);
         }
     }
@@ -111,16 +284,99 @@ void parse_args(int ac, char **av)
     // Positionnal arguments
     if (optind < ac)
         args.filename = av[optind];
+
+    // GBS files are always rendered headless
+    if (args.filename && strlen(args.filename) > 4
+        && !strcasecmp(args.filename + strlen(args.filename) - 4, ".gbs"))
+    {
+        args.gbs = true;
+        if (!args.headless_opts.audio_file) {
+            fprintf(stderr, "GBS files can only be rendered to a file (-w)\n");
+            exit(EXIT_FAILURE);
+        }
+        if (!args.headless) {
+            args.headless = true;
+            args.headless_opts.seconds = GBS_DEFAULT_SECONDS;
+        }
+    }
+
+    if (!args.headless && args.headless_opts.audio_file) {
+        fprintf(stderr, "Audio capture (-w) requires headless mode (-H)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (args.headless_opts.audio_stems && !args.headless_opts.audio_file) {
+        fprintf(stderr, "Channel capture (-W) requires an audio file (-w)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (args.headless && !args.filename) {
+        fprintf(stderr, "Headless mode requires a ROM filename\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
+// Render the tracks of a GBS file
+int render_gbs(void)
+{
+    struct headless_options opts = args.headless_opts;
+    int first, last;
+    int ret = 0;
+    char tag[12];
+    char *filename;
+    gb_system_t *gb;
+    gbs_t *gbs;
+
+    if (!(gbs = gbs_load_file(args.filename)))
+        return EXIT_FAILURE;
+
+    printf("GBS: %s - %s (%s), %u tracks\n", gbs->title, gbs->author, gbs->copyright, gbs->songs);
+    if (args.gbs_track > gbs->songs) {
+        fprintf(stderr, "Invalid track: %i (%u tracks)\n", args.gbs_track, gbs->songs);
+        gbs_destroy(gbs);
+        return EXIT_FAILURE;
+    }
+    first = args.gbs_track ? args.gbs_track : 1;
+    last = args.gbs_track ? args.gbs_track : gbs->songs;
+    opts.run = &gbs_run;
+
+    for (int track = first; track <= last && ret == 0; ++track) {
+        if (!(gb = gbs_create_system(gbs, track - 1))) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        // Each track goes to its own file when rendering all of them
+        if (args.gbs_track) {
+            filename = NULL;
+            opts.audio_file = args.headless_opts.audio_file;
+        } else {
+            snprintf(tag, sizeof(tag), "%02d", track);
+            filename = headless_filename(args.headless_opts.audio_file, tag);
+            opts.audio_file = filename;
+        }
+
+        printf("Track %i/%u: %s\n", track, gbs->songs, opts.audio_file);
+        if (emulate_headless(&opts, gb) != 0)
+            ret = EXIT_FAILURE;
+
+        free(filename);
+        gb_system_destroy(gb);
+    }
+
+    gbs_destroy(gbs);
+    return ret;
+}
 
 int main(int ac, char **av)
 {
     int emulation_ret = -1;
+    serial_sink_t *sink = NULL;
     gb_system_t *gb;
 
     parse_args(ac, av);
-    initialize_sdl();
+    if (args.gbs)
+        return render_gbs();
+    if (!args.headless)
+        initialize_sdl();
     if (!args.filename) {
         args.filename_alloc = true;
         if (!(args.filename = ask_for_file_drop())) {
@@ -133,12 +389,57 @@ int main(int ac, char **av)
         return EXIT_FAILURE;
     if (args.filename_alloc)
         free(args.filename);
+    gb->screen.pixel_fifo = args.pixel_fifo;
+    gb->screen.dma_accurate = args.dma_accurate;
+    gb->memory.rtc_source = args.rtc_source;
+    gb->memory.rtc_epoch = args.rtc_epoch;
+    if (args.link_name && !link_plug_shm(args.link_name, gb)) {
+        gb_system_destroy(gb);
+        return EXIT_FAILURE;
+    }
+    if (args.trace_file || args.trace_stream || args.trace_log || args.trace_reference) {
+        cpu_trace_enable(CPU_TRACE_DEFAULT_SIZE, args.trace_file, gb);
+        if (   (args.trace_stream && !cpu_trace_stream(args.trace_stream, gb))
+            || (args.trace_log && !cpu_trace_log(args.trace_log, gb))
+            || (args.trace_reference && !cpu_trace_compare(args.trace_reference, gb)))
+        {
+            gb_system_destroy(gb);
+            return EXIT_FAILURE;
+        }
+    }
+    if (args.profile_file)
+        profiler_enable(gb);
+    if (args.serial_file || args.serial_patterns_nb > 0) {
+        sink = serial_sink_create(NULL, 0);
+        if (args.serial_file && !serial_sink_open(sink, args.serial_file)) {
+            serial_sink_destroy(sink);
+            gb_system_destroy(gb);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < args.serial_patterns_nb; ++i)
+            serial_sink_stop_on(sink, args.serial_patterns[i]);
+        gb->serial.sink = sink;
+    }
 
     if (args.debug) {
         cartridge_dump(&gb->cartridge);
     }
 
-    emulation_ret = emulate_gameboy(gb, !args.no_audio);
+    if (args.headless) {
+        emulation_ret = emulate_headless(&args.headless_opts, gb);
+    } else {
+        emulation_ret = emulate_gameboy(gb, !args.no_audio);
+    }
+    // Reaching the end of the reference stops the CPU, only a divergence
+    // is a failure
+    if (args.trace_reference && emulation_ret >= 0)
+        emulation_ret = gb->trace->diverged ? 1 : 0;
+    if (args.profile_file) {
+        profiler_write_folded(args.profile_file, gb);
+        profiler_report(stdout, PROFILER_DEFAULT_TOP, gb);
+    }
     gb_system_destroy(gb);
-    return emulation_ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
-}
\ No newline at end of file
+    if (sink)
+        serial_sink_destroy(sink);
+    return emulation_ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -26,12 +26,35 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 #define mbc3_regs ((mbc3_regs_t *) gb->memory.mbc_regs)
 
-void mbc3_rtc_tick_timestamp(gb_system_t *gb)
+// Returns the current time of the RTC source in seconds
+static time_t mbc3_rtc_now(gb_system_t *gb)
 {
-    time_t current_tick = time(NULL);
-    time_t elapsed = current_tick - mbc3_regs->last_tick;
+    const time_t emulated = (time_t) (gb->cycle_nb / CPU_CLOCK_SPEED);
+
+    switch (gb->memory.rtc_source) {
+        case RTC_SOURCE_EMULATED: return mbc3_regs->base + emulated;
+        case RTC_SOURCE_FIXED   : return (time_t) gb->memory.rtc_epoch + emulated;
+        default                 : return time(NULL);
+    }
+}
+
+// Tick the RTC by the time elapsed since last_tick was saved
+// saved_source is the RTC source that last_tick was taken from, a host clock
+// never catches up on an emulated one
+void mbc3_rtc_tick_timestamp(enum rtc_source saved_source, gb_system_t *gb)
+{
+    time_t current_tick;
+    time_t elapsed;
     time_t total_d;
 
+    if (gb->memory.rtc_source == RTC_SOURCE_EMULATED)
+        mbc3_regs->base = mbc3_regs->last_tick - (time_t) (gb->cycle_nb / CPU_CLOCK_SPEED);
+    if (gb->memory.rtc_source == RTC_SOURCE_HOST && saved_source != RTC_SOURCE_HOST)
+        current_tick = mbc3_regs->last_tick;
+    else
+        current_tick = mbc3_rtc_now(gb);
+    elapsed = current_tick - mbc3_regs->last_tick;
+
     if (elapsed > 0) {
         logger(LOG_ALL, "mbc3: Ticking %li seconds", elapsed);
         total_d = elapsed / 60 / 60 / 24;
@@ -57,7 +80,6 @@ void mbc3_rtc_tick_timestamp(gb_system_t *gb)
 
 static void mbc3_rtc_tick(gb_system_t *gb)
 {
-    mbc3_regs->last_tick = time(NULL);
     if ((mbc3_regs->rtc.rtc_s += 1) >= 60) {
         mbc3_regs->rtc.rtc_s = 0;
         if ((mbc3_regs->rtc.rtc_m += 1) >= 60) {
@@ -74,12 +96,22 @@ static void mbc3_rtc_tick(gb_system_t *gb)
     }
 }
 
-void mbc3_clock(gb_system_t *gb)
+// Emulate the RTC up to the current cycle
+// It is only needed when the RTC registers are latched, written or saved
+void mbc3_rtc_sync(gb_system_t *gb)
 {
-    if (!mbc3_regs->rtc.rtc_dh.d.halt && (mbc3_regs->clocks += 1) >= CPU_CLOCK_SPEED) {
-        mbc3_regs->clocks = 0;
-        mbc3_rtc_tick(gb);
+    size_t seconds;
+
+    if (!mbc3_regs->rtc.rtc_dh.d.halt) {
+        mbc3_regs->clocks += gb->cycle_nb - mbc3_regs->cycle;
+        seconds = mbc3_regs->clocks / CPU_CLOCK_SPEED;
+        mbc3_regs->clocks %= CPU_CLOCK_SPEED;
+        if (seconds > 0)
+            mbc3_regs->last_tick = mbc3_rtc_now(gb);
+        for (; seconds > 0; --seconds)
+            mbc3_rtc_tick(gb);
     }
+    mbc3_regs->cycle = gb->cycle_nb;
 }
 
 int16_t mbc3_readb(uint16_t addr, gb_system_t *gb)
@@ -135,6 +167,7 @@ bool mbc3_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
         case 0x7:
             value &= 0x1;
             if (mbc3_regs->latch_reg == 0x0 && value) {
+                mbc3_rtc_sync(gb);
                 mbc3_regs->latch.rtc_s = mbc3_regs->rtc.rtc_s & 0x3F;
                 mbc3_regs->latch.rtc_m = mbc3_regs->rtc.rtc_m & 0x3F;
                 mbc3_regs->latch.rtc_h = mbc3_regs->rtc.rtc_h & 0x1F;
@@ -159,6 +192,7 @@ bool mbc3_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
 
             if (gb->memory.ram.can_write) {
                 logger(LOG_ALL, "mbc3_writeb: $%02X to RTC $%02X", value, mbc3_regs->ram_bank);
+                mbc3_rtc_sync(gb);
                 switch (mbc3_regs->ram_bank) {
                     case RTC_S : mbc3_regs->rtc.rtc_s = value; break;
                     case RTC_M : mbc3_regs->rtc.rtc_m = value; break;
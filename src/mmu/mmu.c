@@ -21,6 +21,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "xalloc.h"
 #include "gameboy.h"
 #include "mmu/mmu_internal.h"
+#include "mmu/rambanks.h"
 #include "mmu/mbc1.h"
 #include "mmu/mbc3.h"
 #include "mmu/mbc5.h"
@@ -84,11 +85,23 @@ byte_t mmu_bootrom_readb(byte_t addr, __attribute__((unused)) gb_system_t *gb)
     return bootrom[addr];
 }
 
+// Returns true if the CPU cannot access addr because of an OAM DMA transfer
+// (accurate mode only, HRAM and IO registers remain accessible)
+static inline bool mmu_dma_blocked(uint16_t addr, gb_system_t *gb)
+{
+    return gb->screen.dma_running && addr < IO_REGISTERS_LADDR;
+}
+
 // Read byte from addr
 byte_t mmu_readb(uint16_t addr, gb_system_t *gb)
 {
     int16_t value;
 
+    if (mmu_dma_blocked(addr, gb)) {
+        logger(LOG_ALL, "mmu_readb failed: address $%04X: Bus is used by OAM DMA", addr);
+        return MMU_UNMAPPED_ADDR_VALUE;
+    }
+
     if (!gb->memory.bootrom_reg && addr <= 0xFF)
         return mmu_bootrom_readb(addr, gb);
 
@@ -123,6 +136,10 @@ byte_t mmu_readb_nolog(uint16_t addr, gb_system_t *gb)
 bool mmu_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
 {
     logger(LOG_ALL, "mmu_writeb: write $%02X at address $%04X", value, addr);
+    if (mmu_dma_blocked(addr, gb)) {
+        logger(LOG_ALL, "mmu_writeb failed: address $%04X: Bus is used by OAM DMA", addr);
+        return false;
+    }
     if (gb->memory.mbc_writeb) {
         if ((*gb->memory.mbc_writeb)(addr, value, gb))
             return true;
@@ -130,6 +147,42 @@ bool mmu_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
     return mmu_internal_writeb(addr, value, gb);
 }
 
+// Returns a pointer to the memory mapped at addr if the 256 bytes from addr
+// can be accessed directly, NULL otherwise
+const byte_t *mmu_page(uint16_t addr, gb_system_t *gb)
+{
+    switch (addr >> 8) {
+        case 0x00 ... 0x3F: // ROM 0
+            if (!gb->memory.bootrom_reg && addr <= 0xFF)
+                return NULL;
+            return gb->memory.rom.banks[gb->memory.rom.bank_0] + addr;
+
+        case 0x40 ... 0x7F: // ROM Bank
+            return gb->memory.rom.banks[gb->memory.rom.bank_n] + (addr - ROM_BANK_N_LADDR);
+
+        case 0x80 ... 0x9F: // VRAM
+            return gb->memory.vram + (addr - VRAM_LADDR);
+
+        case 0xA0 ... 0xBF: // RAM Bank
+            if (   gb->memory.mbc_readb
+                || !rambank_exists(&gb->memory.ram)
+                || !gb->memory.ram.can_read
+                || (addr - RAM_BANK_N_LADDR) + 0x100 > gb->memory.ram.bank_size)
+            {
+                return NULL;
+            }
+            return gb->memory.ram.banks[gb->memory.ram.bank] + (addr - RAM_BANK_N_LADDR);
+
+        case 0xC0 ... 0xDF: // Work RAM
+            return gb->memory.wram + (addr - RAM_BANK_0_LADDR);
+
+        case 0xE0 ... 0xFD: // Echo RAM
+            return gb->memory.wram + (addr - RAM_ECHO_LADDR);
+
+        default: return NULL;
+    }
+}
+
 // Read uint16 from addr
 uint16_t mmu_read_u16(uint16_t addr, gb_system_t *gb)
 {
@@ -165,6 +218,8 @@ bool mmu_battery_save(gb_system_t *gb)
     int fd;
     size_t offset;
     ssize_t n;
+    byte_t rtc_source;
+    uint32_t rtc_clocks;
 
     if ((fd = open(gb->sav_file, OFLAG | O_WRONLY | O_CREAT,
                                  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH)) < 0) {
@@ -190,12 +245,17 @@ bool mmu_battery_save(gb_system_t *gb)
     switch (gb->cartridge.mbc_type) {
         case 0x0F: // MBC3 + Timer + Battery
         case 0x10: // MBC3 + Timer + RAM + Battery
+            mbc3_rtc_sync(gb);
             write(fd, &((mbc3_regs_t *) gb->memory.mbc_regs)->rtc.rtc_s, 1);
             write(fd, &((mbc3_regs_t *) gb->memory.mbc_regs)->rtc.rtc_m, 1);
             write(fd, &((mbc3_regs_t *) gb->memory.mbc_regs)->rtc.rtc_h, 1);
             write(fd, &((mbc3_regs_t *) gb->memory.mbc_regs)->rtc.rtc_dl, 1);
             write(fd, &((mbc3_regs_t *) gb->memory.mbc_regs)->rtc.rtc_dh.b, 1);
             write(fd, &((mbc3_regs_t *) gb->memory.mbc_regs)->last_tick, sizeof(time_t));
+            rtc_source = (byte_t) gb->memory.rtc_source;
+            rtc_clocks = (uint32_t) ((mbc3_regs_t *) gb->memory.mbc_regs)->clocks;
+            write(fd, &rtc_source, 1);
+            write(fd, &rtc_clocks, sizeof(uint32_t));
             logger(LOG_DEBUG, "Saved MBC3 RTC registers");
 
         default: break;
@@ -213,6 +273,8 @@ bool mmu_battery_load(gb_system_t *gb)
     int fd;
     size_t offset;
     ssize_t n;
+    byte_t rtc_source;
+    uint32_t rtc_clocks;
 
     if ((fd = open(gb->sav_file, OFLAG | O_RDONLY)) < 0) {
         fprintf(stderr, "open(): %s: %s\n", gb->sav_file, strerror(errno));
@@ -247,8 +309,19 @@ bool mmu_battery_load(gb_system_t *gb)
                 logger(LOG_ERROR, "read(): %s: Failed to load MBC3 RTC registers: %s", gb->sav_file, strerror(errno));
                 memset(gb->memory.mbc_regs, 0, sizeof(mbc3_regs_t));
             } else {
+                // Older battery files end after the timestamp, it was
+                // always taken from the host clock
+                if (   read(fd, &rtc_source, 1) != 1
+                    || read(fd, &rtc_clocks, sizeof(uint32_t)) != sizeof(uint32_t)
+                    || rtc_source > RTC_SOURCE_FIXED
+                    || rtc_clocks >= CPU_CLOCK_SPEED)
+                {
+                    rtc_source = RTC_SOURCE_HOST;
+                } else {
+                    ((mbc3_regs_t *) gb->memory.mbc_regs)->clocks = rtc_clocks;
+                }
                 logger(LOG_DEBUG, "Loaded MBC3 RTC registers");
-                mbc3_rtc_tick_timestamp(gb);
+                mbc3_rtc_tick_timestamp((enum rtc_source) rtc_source, gb);
             }
             break;
 
@@ -304,7 +377,6 @@ bool mmu_set_mbc(byte_t mbc_type, gb_system_t *gb)
         case 0x11: // MBC3
             gb->memory.mbc_readb = &mbc3_readb;
             gb->memory.mbc_writeb = &mbc3_writeb;
-            gb->memory.mbc_clock = &mbc3_clock;
             gb->memory.mbc_regs = xzalloc(sizeof(mbc3_regs_t));
             gb->memory.mbc_regs_size = sizeof(mbc3_regs_t);
             return true;
@@ -165,6 +165,9 @@ bool mmu_internal_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
                     }
                     gb->memory.oam[addr & 0xFF] = value;
 
+                    // Sprite Y or X coordinate changed
+                    if ((addr & 0x3) < 2)
+                        gb->screen.oam_dirty = true;
                 }
                 return true;
 
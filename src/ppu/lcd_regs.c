@@ -20,6 +20,8 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 #include "logger.h"
 #include "gameboy.h"
+#include "scheduler.h"
+#include "ppu/ppu.h"
 
 byte_t lcd_reg_readb(uint16_t addr, gb_system_t *gb)
 {
@@ -28,7 +30,7 @@ byte_t lcd_reg_readb(uint16_t addr, gb_system_t *gb)
         case LCDC_STATUS: return (*((byte_t *) &gb->screen.lcd_stat)) | 0x80;
         case LCDC_SCY   : return gb->screen.scy;
         case LCDC_SCX   : return gb->screen.scx;
-        case LCDC_LY    : return gb->screen.ly;
+        case LCDC_LY    : return gb->screen.ly_stub ? 0x90 : gb->screen.ly;
         case LCDC_LYC   : return gb->screen.lyc;
         case LCDC_WY    : return gb->screen.wy;
         case LCDC_WX    : return gb->screen.wx;
@@ -49,6 +51,9 @@ bool lcd_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
             if (gb->screen.lcdc.enable && !(value & 0x80) && gb->screen.lcd_stat.mode != LCDC_MODE_VBLANK)
                 logger(LOG_CRIT, "LCD screen should only be disabled during VBlank! (currently mode %u)", gb->screen.lcd_stat.mode);
 
+            if (gb->screen.lcdc.obj_size != ((value >> 2) & 1))
+                gb->screen.oam_dirty = true;
+
             (*((byte_t *) &gb->screen.lcdc)) = value;
             if (!gb->screen.lcdc.enable) {
                 gb->screen.lcd_stat.mode = LCDC_MODE_0;
@@ -69,8 +74,12 @@ bool lcd_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
                 logger(LOG_ERROR, "lcd_reg_writeb failed: DMA value cannot exceed $F1");
             } else {
                 gb->screen.dma_src = value << 8;
-                gb->screen.dma_offset = 0;
-                gb->screen.dma_running = LCD_DMA_CYCLES;
+                if (gb->screen.dma_accurate) {
+                    gb->screen.dma_running = true;
+                    scheduler_add(EVENT_DMA_END, gb->cycle_nb + LCD_DMA_CYCLES, gb);
+                } else {
+                    ppu_dma_transfer(gb);
+                }
             }
             break;
 
@@ -23,11 +23,19 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "cpu/interrupts.h"
 #include "mmu/mmu.h"
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define SHADE_FROM_PALETTE(id, palette) ((palette >> (id * 2)) & 0x3)
 #define BG_MAP_2_OFFSET (BG_MAP_2_LADDR - TILE_LADDR)
 #define BG_MAP_1_OFFSET (BG_MAP_1_LADDR - TILE_LADDR)
 
+// Dots spent before the first tile fetch of mode 3 (includes the discarded
+// tile fetch), a scanline without scrolling or sprites takes
+// LCD_MODE_3_CYCLES dots
+#define PPU_FIFO_STARTUP_DOTS (7)
+
 const pixel_t monochrome_pal[4] = {
     { .r = 0xFF, .g = 0xFF, .b = 0xFF},
     { .r = 0xBF, .g = 0xBF, .b = 0xBF},
@@ -35,22 +43,93 @@ const pixel_t monochrome_pal[4] = {
     { .r = 0x00, .g = 0x00, .b = 0x00}
 };
 
+#ifdef __SSE2__
+// Composite a sprite's 8 pixels row at sl_x (padded index)
+// Every mask is computed for the 8 pixels at once and merged into the
+// scanline buffers using and/andnot/or selects
+static inline void ppu_composite_sprite_row(const byte_t sl_x,
+    const byte_t tile_lo, const byte_t tile_hi, const bool x_flip,
+    const bool behind_bg, const byte_t palette, gb_system_t *gb)
+{
+    // Spread the 8 bits of each tile byte to 8 bytes, leftmost pixel first
+    uint64_t lo = (((tile_lo * 0x8040201008040201ULL) & 0x8080808080808080ULL) >> 7);
+    uint64_t hi = (((tile_hi * 0x8040201008040201ULL) & 0x8080808080808080ULL) >> 6);
+    uint64_t row = x_flip ? __builtin_bswap64(lo | hi) : (lo | hi);
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i ids = _mm_loadl_epi64((const __m128i *) &row);
+    __m128i bg_ids = _mm_loadl_epi64((const __m128i *) &gb->screen.sl_bg_shade_id[sl_x]);
+    __m128i obj_ids = _mm_loadl_epi64((const __m128i *) &gb->screen.sl_sprite_shade_id[sl_x]);
+    __m128i obj_shades = _mm_loadl_epi64((const __m128i *) &gb->screen.sl_sprite_shade[sl_x]);
+
+    // Shade 0 is transparent for sprites, a pixel is drawn only if it is
+    // opaque, not behind the background and not over another sprite
+    __m128i hidden = _mm_cmpgt_epi8(obj_ids, _mm_set1_epi8(-1));
+    if (behind_bg)
+        hidden = _mm_or_si128(hidden, _mm_xor_si128(_mm_cmpeq_epi8(bg_ids, zero), _mm_set1_epi8(-1)));
+    __m128i draw = _mm_andnot_si128(_mm_or_si128(hidden, _mm_cmpeq_epi8(ids, zero)), _mm_set1_epi8(-1));
+
+    // Apply the palette (transparent pixels are masked out by draw)
+    __m128i shades = _mm_or_si128(
+        _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(ids, _mm_set1_epi8(1)), _mm_set1_epi8(SHADE_FROM_PALETTE(1, palette))),
+            _mm_and_si128(_mm_cmpeq_epi8(ids, _mm_set1_epi8(2)), _mm_set1_epi8(SHADE_FROM_PALETTE(2, palette)))),
+        _mm_and_si128(_mm_cmpeq_epi8(ids, _mm_set1_epi8(3)), _mm_set1_epi8(SHADE_FROM_PALETTE(3, palette))));
+
+    obj_ids = _mm_or_si128(_mm_and_si128(draw, ids), _mm_andnot_si128(draw, obj_ids));
+    obj_shades = _mm_or_si128(_mm_and_si128(draw, shades), _mm_andnot_si128(draw, obj_shades));
+    _mm_storel_epi64((__m128i *) &gb->screen.sl_sprite_shade_id[sl_x], obj_ids);
+    _mm_storel_epi64((__m128i *) &gb->screen.sl_sprite_shade[sl_x], obj_shades);
+}
+#else
+// Composite a sprite's 8 pixels row at sl_x (padded index)
+static inline void ppu_composite_sprite_row(const byte_t sl_x,
+    const byte_t tile_lo, const byte_t tile_hi, const bool x_flip,
+    const bool behind_bg, const byte_t palette, gb_system_t *gb)
+{
+    for (byte_t pixel = 0; pixel < 8; ++pixel) {
+        byte_t pixel_bit = x_flip ? pixel : (7 - pixel);
+        byte_t pixel_shade_id = (((tile_hi >> pixel_bit) & 1) << 1) | ((tile_lo >> pixel_bit) & 1);
+        byte_t x = sl_x + pixel;
+
+        // Shade 0 is transparent for sprites
+        if (pixel_shade_id == 0)
+            continue;
+
+        // Object pixel is behind background
+        if (behind_bg && gb->screen.sl_bg_shade_id[x] != 0)
+            continue;
+
+        // Sprite overlap
+        if (gb->screen.sl_sprite_shade_id[x] >= 0)
+            continue;
+
+        gb->screen.sl_sprite_shade_id[x] = pixel_shade_id;
+        gb->screen.sl_sprite_shade[x] = SHADE_FROM_PALETTE(pixel_shade_id, palette);
+    }
+}
+#endif
+
 // Draw sprites on given scanline
 void ppu_draw_sprites(const byte_t scanline, gb_system_t *gb)
 {
     byte_t sprite_height = 8 + (gb->screen.lcdc.obj_size * 8);
-    int16_t y, x, line;
+    int16_t y, line;
     uint16_t tile_data_addr;
-    byte_t tile_id, tile_lo, tile_hi;
-    byte_t palette;
+    byte_t tile_id;
     oam_entry_t *oam_entry;
 
+    if (scanline >= SCREEN_HEIGHT)
+        return;
+
     memset(gb->screen.sl_sprite_shade_id, -1, sizeof(gb->screen.sl_sprite_shade_id));
     for (byte_t i = 0; i < gb->screen.oam_buffer_size; ++i) {
         oam_entry = gb->screen.oam_sorted[i];
         y = oam_entry->y - 16;
-        x = oam_entry->x - 8;
-        palette = oam_entry->attr.dmg_palette ? gb->screen.obp1 : gb->screen.obp0;
+
+        // Sprites entirely off-screen horizontally are still selected
+        if (oam_entry->x == 0 || oam_entry->x >= SCREEN_WIDTH + 8)
+            continue;
 
         if (oam_entry->attr.y_flip) {
             line = (-(scanline - y - (sprite_height - 1)) * 2);
@@ -65,34 +144,19 @@ void ppu_draw_sprites(const byte_t scanline, gb_system_t *gb)
             continue;
         }
 
-        tile_lo = gb->memory.vram[tile_data_addr];
-        tile_hi = gb->memory.vram[tile_data_addr + 1];
-
-        for (sbyte_t pixel = 7; pixel >= 0; --pixel) {
-            sbyte_t pixel_bit = oam_entry->attr.x_flip ? (-(pixel - 7)) : pixel;
-            byte_t pixel_shade_id = (((tile_hi >> pixel_bit) & 1) << 1) | ((tile_lo >> pixel_bit) & 1);
-
-            // Shade 0 is transparent for sprites
-            if (pixel_shade_id == 0)
-                continue;
-
-            byte_t pixel_shade = SHADE_FROM_PALETTE(pixel_shade_id, palette);
-            int16_t pixel_x = x + (7 - pixel);
-
-            if (scanline >= SCREEN_HEIGHT || pixel_x < 0 || pixel_x >= SCREEN_WIDTH)
-                continue;
-
-            // Object pixel is behind background
-            if (oam_entry->attr.obj_behind_bg && gb->screen.sl_bg_shade_id[pixel_x] != 0)
-                continue;
-
-            // Sprite overlap
-            if (gb->screen.sl_sprite_shade_id[pixel_x] >= 0)
-                continue;
+        // Sprite X is offset by 8, the same as the scanline buffers
+        ppu_composite_sprite_row(oam_entry->x,
+                                 gb->memory.vram[tile_data_addr],
+                                 gb->memory.vram[tile_data_addr + 1],
+                                 oam_entry->attr.x_flip,
+                                 oam_entry->attr.obj_behind_bg,
+                                 oam_entry->attr.dmg_palette ? gb->screen.obp1 : gb->screen.obp0,
+                                 gb);
+    }
 
-            gb->screen.framebuffer[scanline][pixel_x] = monochrome_pal[pixel_shade];
-            gb->screen.sl_sprite_shade_id[pixel_x] = pixel_shade_id;
-        }
+    for (byte_t x = 0; x < SCREEN_WIDTH; ++x) {
+        if (gb->screen.sl_sprite_shade_id[SL_PADDING + x] >= 0)
+            gb->screen.framebuffer[scanline][x] = monochrome_pal[gb->screen.sl_sprite_shade[SL_PADDING + x]];
     }
 }
 
@@ -147,7 +211,7 @@ void ppu_draw_background(const byte_t scanline, gb_system_t *gb)
             continue;
 
         gb->screen.framebuffer[scanline][pixel] = monochrome_pal[pixel_shade];
-        gb->screen.sl_bg_shade_id[pixel] = pixel_shade_id;
+        gb->screen.sl_bg_shade_id[SL_PADDING + pixel] = pixel_shade_id;
     }
     if (window_drawn)
         gb->screen.window_scanline += 1;
@@ -156,100 +220,309 @@ void ppu_draw_background(const byte_t scanline, gb_system_t *gb)
 // Draw scanline
 void ppu_draw_scanline(const byte_t scanline, gb_system_t *gb)
 {
-#ifdef PPU_USE_PIXEL_FIFO
-#error "Pixel FIFO not implemented yet"
-#else
     if (gb->screen.lcdc.bg_display)
         ppu_draw_background(scanline, gb);
 
     if (gb->screen.lcdc.obj_display)
         ppu_draw_sprites(scanline, gb);
-#endif
 }
 
-// Bubble-sort OAM buffer for sprite priority
-void ppu_oam_sort(gb_system_t *gb)
+// Initialize the pixel FIFO when entering mode 3
+void ppu_fifo_start(gb_system_t *gb)
 {
-    bool sorted = false;
-    oam_entry_t *tmp;
+    memset(&gb->screen.fifo, 0, sizeof(gb->screen.fifo));
 
-    for (byte_t i = 0; i < gb->screen.oam_buffer_size; ++i)
-        gb->screen.oam_sorted[i] = &gb->screen.oam_buffer[i];
-
-    while (!sorted) {
-        sorted = true;
-        for (byte_t i = 1; i < gb->screen.oam_buffer_size; ++i) {
-            if (gb->screen.oam_sorted[i - 1]->x > gb->screen.oam_sorted[i]->x) {
-                tmp = gb->screen.oam_sorted[i];
-                gb->screen.oam_sorted[i] = gb->screen.oam_sorted[i - 1];
-                gb->screen.oam_sorted[i - 1] = tmp;
-                sorted = false;
+    // The first tile fetch of a scanline is discarded
+    gb->screen.fifo.stall = PPU_FIFO_STARTUP_DOTS;
+    gb->screen.fifo.discard = gb->screen.scx % 8;
+}
+
+// Fetch the tile ID and tile data of the next background or window tile
+static void ppu_fifo_fetch_tile(gb_system_t *gb)
+{
+    struct ppu_fifo *fifo = &gb->screen.fifo;
+    uint16_t tile_map_addr, tile_data_addr;
+    byte_t x, y;
+
+    if (fifo->window) {
+        tile_map_addr = gb->screen.lcdc.window_select ? BG_MAP_2_OFFSET : BG_MAP_1_OFFSET;
+        x = fifo->fetch_x;
+        y = gb->screen.window_scanline;
+    } else {
+        tile_map_addr = gb->screen.lcdc.bg_tilemap_select ? BG_MAP_2_OFFSET : BG_MAP_1_OFFSET;
+        x = ((gb->screen.scx / 8) + fifo->fetch_x) % 32;
+        y = gb->screen.ly + gb->screen.scy;
+    }
+
+    switch (fifo->fetch_dots) {
+        case 2: // Get tile ID
+            fifo->tile_id = gb->memory.vram[tile_map_addr + ((y / 8) * 32) + x];
+            break;
+
+        case 4: // Get tile data (low)
+        case 6: // Get tile data (high)
+            if (gb->screen.lcdc.bg_select) {
+                tile_data_addr = fifo->tile_id * 16;
+            } else {
+                tile_data_addr = 0x800 + ((((sbyte_t) fifo->tile_id) + 128) * 16);
             }
+            tile_data_addr += (y % 8) * 2;
+
+            if (fifo->fetch_dots == 4) {
+                fifo->tile_lo = gb->memory.vram[tile_data_addr];
+            } else {
+                fifo->tile_hi = gb->memory.vram[tile_data_addr + 1];
+            }
+            break;
+
+        default: break;
+    }
+}
+
+// Fetch the pixels of a sprite and mix them into the sprite FIFO
+static void ppu_fifo_fetch_sprite(const oam_entry_t *oam_entry, gb_system_t *gb)
+{
+    struct ppu_fifo *fifo = &gb->screen.fifo;
+    byte_t sprite_height = 8 + (gb->screen.lcdc.obj_size * 8);
+    int16_t y = oam_entry->y - 16;
+    int16_t line, pixel_x;
+    uint16_t tile_data_addr;
+    byte_t tile_id, tile_lo, tile_hi;
+    byte_t pixel_bit, pixel_shade_id, slot;
+
+    if (oam_entry->attr.y_flip) {
+        line = (-(gb->screen.ly - y - (sprite_height - 1)) * 2);
+    } else {
+        line = ((gb->screen.ly - y) * 2);
+    }
+
+    tile_id = gb->screen.lcdc.obj_size ? (oam_entry->tile_id & 0xFE) : oam_entry->tile_id;
+    tile_data_addr = (tile_id * 16) + line;
+    if ((unsigned) (tile_data_addr + 1) >= sizeof(gb->memory.vram)) {
+        logger(LOG_CRIT, "ppu_fifo_fetch_sprite: tile_data_addr out of bounds: %X", tile_data_addr);
+        return;
+    }
+    tile_lo = gb->memory.vram[tile_data_addr];
+    tile_hi = gb->memory.vram[tile_data_addr + 1];
+
+    for (byte_t pixel = 0; pixel < 8; ++pixel) {
+        // Skip the pixels that are off-screen or already output
+        pixel_x = oam_entry->x - 8 + pixel;
+        if (pixel_x < fifo->lx)
+            continue;
+
+        pixel_bit = oam_entry->attr.x_flip ? pixel : (7 - pixel);
+        pixel_shade_id = (((tile_hi >> pixel_bit) & 1) << 1) | ((tile_lo >> pixel_bit) & 1);
+
+        // Sprites fetched earlier have priority over this one, only the
+        // transparent pixels are replaced
+        slot = (fifo->obj_head + (pixel_x - fifo->lx)) % 8;
+        if (fifo->obj_shade_id[slot] == 0 && pixel_shade_id != 0) {
+            fifo->obj_shade_id[slot] = pixel_shade_id;
+            fifo->obj_attr[slot] = oam_entry->attr.dmg_palette
+                                 | (oam_entry->attr.obj_behind_bg << 1);
         }
     }
 }
 
-// Fetch the OAM buffer (complete OAM search)
-void ppu_oam_search(gb_system_t *gb)
+// Output the next pixel of the FIFOs to the framebuffer
+static void ppu_fifo_output_pixel(gb_system_t *gb)
+{
+    struct ppu_fifo *fifo = &gb->screen.fifo;
+    byte_t bg_shade_id, obj_shade_id, obj_attr;
+    byte_t pixel_shade;
+
+    bg_shade_id = ((fifo->bg_hi >> 7) << 1) | (fifo->bg_lo >> 7);
+    fifo->bg_lo <<= 1;
+    fifo->bg_hi <<= 1;
+    fifo->bg_size -= 1;
+
+    // Fine scrolling drops pixels before they reach the LCD
+    if (fifo->discard > 0) {
+        fifo->discard -= 1;
+        return;
+    }
+
+    obj_shade_id = fifo->obj_shade_id[fifo->obj_head];
+    obj_attr = fifo->obj_attr[fifo->obj_head];
+    fifo->obj_shade_id[fifo->obj_head] = 0;
+    fifo->obj_head = (fifo->obj_head + 1) % 8;
+
+    // Palettes are read when the pixel is output so that writes during
+    // mode 3 affect the rest of the scanline
+    if (!gb->screen.lcdc.bg_display)
+        bg_shade_id = 0;
+
+    if (   obj_shade_id != 0
+        && gb->screen.lcdc.obj_display
+        && !((obj_attr & 0x2) && bg_shade_id != 0))
+    {
+        pixel_shade = SHADE_FROM_PALETTE(obj_shade_id, (obj_attr & 0x1) ? gb->screen.obp1 : gb->screen.obp0);
+    } else {
+        pixel_shade = SHADE_FROM_PALETTE(bg_shade_id, gb->screen.bgp);
+    }
+
+    gb->screen.framebuffer[gb->screen.ly][fifo->lx] = monochrome_pal[pixel_shade];
+    if ((fifo->lx += 1) >= SCREEN_WIDTH)
+        fifo->done = true;
+}
+
+// Emulate a mode 3 dot with the pixel FIFO
+void ppu_fifo_cycle(gb_system_t *gb)
+{
+    struct ppu_fifo *fifo = &gb->screen.fifo;
+    const oam_entry_t *oam_entry;
+    uint16_t penalty;
+
+    if (fifo->done)
+        return;
+
+    if (fifo->stall > 0) {
+        fifo->stall -= 1;
+        return;
+    }
+
+    // Switch to the window, this restarts the fetcher with an empty FIFO
+    if (   !fifo->window
+        && gb->screen.lcdc.window_display
+        && gb->screen.lcdc.bg_display
+        && gb->screen.wy <= gb->screen.ly
+        && fifo->lx + 7 >= gb->screen.wx)
+    {
+        fifo->window = true;
+        fifo->fetch_x = 0;
+        fifo->fetch_dots = 0;
+        fifo->bg_size = 0;
+        fifo->discard = (gb->screen.wx < 7) ? (7 - gb->screen.wx) : 0;
+    }
+
+    // Fetch the sprites that start at the current pixel, the background
+    // fetcher has to finish its current fetch before the sprite fetch can
+    // start, which then takes another 6 dots
+    if (gb->screen.lcdc.obj_display && fifo->discard == 0) {
+        penalty = 0;
+        while (   fifo->obj_index < gb->screen.oam_buffer_size
+               && gb->screen.oam_sorted[fifo->obj_index]->x <= fifo->lx + 8)
+        {
+            oam_entry = gb->screen.oam_sorted[fifo->obj_index];
+            fifo->obj_index += 1;
+            if (oam_entry->x == 0)
+                continue;
+
+            ppu_fifo_fetch_sprite(oam_entry, gb);
+            if (penalty == 0 && fifo->fetch_dots < 5)
+                penalty += 5 - fifo->fetch_dots;
+            penalty += 6;
+        }
+        if (penalty > 0) {
+            fifo->stall = penalty - 1;
+            return;
+        }
+    }
+
+    // Background/Window fetcher, every step takes 2 dots and the pixels can
+    // only be pushed when the FIFO is empty
+    if (fifo->fetch_dots < 6) {
+        fifo->fetch_dots += 1;
+        ppu_fifo_fetch_tile(gb);
+    }
+    if (fifo->fetch_dots >= 6 && fifo->bg_size == 0) {
+        fifo->bg_lo = fifo->tile_lo;
+        fifo->bg_hi = fifo->tile_hi;
+        fifo->bg_size = 8;
+        fifo->fetch_dots = 0;
+        fifo->fetch_x += 1;
+    }
+
+    if (fifo->bg_size > 0)
+        ppu_fifo_output_pixel(gb);
+}
+
+// Build the list of sprites visible on every scanline
+// Only the first 10 sprites in OAM order are selected on a scanline, they are
+// sorted by X coordinate (then by OAM index) for priority
+void ppu_oam_build_lines(gb_system_t *gb)
 {
     byte_t sprite_height = 8 + (gb->screen.lcdc.obj_size * 8);
-    oam_entry_t *oam_entry;
-    uint16_t sprite_addr;
+    const oam_entry_t *oam_entry;
     int16_t sprite_y_top, sprite_y_bot;
+    byte_t *line_sprites;
+    byte_t j;
 
-    gb->screen.oam_buffer_size = 0;
-    for (byte_t sprite = 0; sprite < 40 && gb->screen.oam_buffer_size < 10; ++sprite) {
-        sprite_addr = sprite * 4;
-        oam_entry = (oam_entry_t *) (gb->memory.oam + sprite_addr);
+    memset(gb->screen.oam_lines_size, 0, sizeof(gb->screen.oam_lines_size));
+    for (byte_t sprite = 0; sprite < MAX_SPRITES; ++sprite) {
+        oam_entry = (const oam_entry_t *) (gb->memory.oam + (sprite * 4));
         sprite_y_top = oam_entry->y - 16;
         sprite_y_bot = sprite_y_top + sprite_height;
-        if (gb->screen.ly >= sprite_y_top && gb->screen.ly < sprite_y_bot) {
-            gb->screen.oam_buffer[gb->screen.oam_buffer_size] = *oam_entry;
-            gb->screen.oam_buffer_size += 1;
+        if (sprite_y_top < 0)
+            sprite_y_top = 0;
+        if (sprite_y_bot > SCREEN_HEIGHT)
+            sprite_y_bot = SCREEN_HEIGHT;
+
+        for (int16_t line = sprite_y_top; line < sprite_y_bot; ++line) {
+            if (gb->screen.oam_lines_size[line] >= 10)
+                continue;
+
+            // Insert the sprite after all the sprites with a lower or
+            // equal X coordinate
+            line_sprites = gb->screen.oam_lines[line];
+            for (j = gb->screen.oam_lines_size[line];
+                 j > 0 && gb->memory.oam[(line_sprites[j - 1] * 4) + 1] > oam_entry->x;
+                 --j)
+            {
+                line_sprites[j] = line_sprites[j - 1];
+            }
+            line_sprites[j] = sprite;
+            gb->screen.oam_lines_size[line] += 1;
         }
     }
+    gb->screen.oam_dirty = false;
 }
 
-// Fetch next valid OAM entry
-void ppu_oam_search_cycle(gb_system_t *gb)
+// Select the sprites of the current scanline (complete OAM search)
+void ppu_oam_search(gb_system_t *gb)
 {
-    byte_t sprite_height = 8 + (gb->screen.lcdc.obj_size * 8);
-    oam_entry_t *oam_entry;
-    uint16_t sprite_addr;
-    int16_t sprite_y_top, sprite_y_bot;
+    const byte_t *line_sprites;
 
-    if (gb->screen.oam_search_index >= 40)
-        return;
+    if (gb->screen.oam_dirty)
+        ppu_oam_build_lines(gb);
+
+    line_sprites = gb->screen.oam_lines[gb->screen.ly];
+    gb->screen.oam_buffer_size = gb->screen.oam_lines_size[gb->screen.ly];
+    for (byte_t i = 0; i < gb->screen.oam_buffer_size; ++i)
+        gb->screen.oam_sorted[i] = (oam_entry_t *) (gb->memory.oam + (line_sprites[i] * 4));
+}
 
-    sprite_addr = gb->screen.oam_search_index * 4;
-    oam_entry = (oam_entry_t *) (gb->memory.oam + sprite_addr);
-    sprite_y_top = oam_entry->y - 16;
-    sprite_y_bot = sprite_y_top + sprite_height;
-    if (gb->screen.oam_buffer_size < 10 && gb->screen.ly >= sprite_y_top && gb->screen.ly < sprite_y_bot) {
-        gb->screen.oam_buffer[gb->screen.oam_buffer_size] = *oam_entry;
-        gb->screen.oam_buffer_size += 1;
+// Copy the DMA source page to OAM
+void ppu_dma_transfer(gb_system_t *gb)
+{
+    const byte_t *src;
+
+    logger(LOG_DEBUG, "DMA Transfer: $%04X to $FE00", gb->screen.dma_src);
+    if ((src = mmu_page(gb->screen.dma_src, gb))) {
+        memcpy(gb->memory.oam, src, OAM_SIZE);
+    } else {
+        // The source is not directly addressable (MBC registers mapped
+        // instead of RAM, disabled RAM banks...)
+        for (uint16_t i = 0; i < OAM_SIZE; ++i)
+            gb->memory.oam[i] = mmu_readb_nolog(gb->screen.dma_src + i, gb);
     }
-    gb->screen.oam_search_index += 1;
+    gb->screen.oam_dirty = true;
+}
+
+// End of an OAM DMA transfer (accurate mode)
+void ppu_dma_end(gb_system_t *gb)
+{
+    gb->screen.dma_running = false;
+    ppu_dma_transfer(gb);
 }
 
-// TODO: Move DMA Transfer to CPU
 // Equivalent of cpu_cycle() for the PPU
 int ppu_cycle(gb_system_t *gb)
 {
     byte_t old_mode;
     bool lcd_stat_int;
 
-    if (gb->screen.dma_running > 0) {
-        logger(LOG_DEBUG,
-               "DMA Transfer: $%04X to $FE%02X",
-               gb->screen.dma_src + gb->screen.dma_offset,
-               gb->screen.dma_offset);
-
-        gb->memory.oam[gb->screen.dma_offset] = mmu_readb(gb->screen.dma_src + gb->screen.dma_offset, gb);
-        gb->screen.dma_offset += 1;
-        gb->screen.dma_running -= 1;
-    }
-
     // LCD is disabled
     if (!gb->screen.lcdc.enable)
         return gb->screen.lcd_stat.mode;
@@ -260,10 +533,18 @@ int ppu_cycle(gb_system_t *gb)
     if (gb->screen.ly < 144) {
         if (gb->screen.scanline_clock < LCD_MODE_2_CYCLES) {
             gb->screen.lcd_stat.mode = LCDC_MODE_2;
-            if ((gb->screen.scanline_clock % 2) == 1) {
-                ppu_oam_search_cycle(gb);
-                if (gb->screen.oam_search_index >= 40)
-                    ppu_oam_sort(gb);
+            if (gb->screen.scanline_clock == LCD_MODE_2_CYCLES - 1)
+                ppu_oam_search(gb);
+        } else if (gb->screen.pixel_fifo) {
+            if (gb->screen.scanline_clock == LCD_MODE_2_CYCLES)
+                ppu_fifo_start(gb);
+
+            // Mode 3 lasts until all the pixels are output
+            if (!gb->screen.fifo.done) {
+                gb->screen.lcd_stat.mode = LCDC_MODE_3;
+                ppu_fifo_cycle(gb);
+            } else {
+                gb->screen.lcd_stat.mode = LCDC_MODE_0;
             }
         } else if (gb->screen.scanline_clock < (LCD_MODE_3_CYCLES + LCD_MODE_2_CYCLES)) {
             gb->screen.lcd_stat.mode = LCDC_MODE_3;
@@ -277,8 +558,13 @@ int ppu_cycle(gb_system_t *gb)
         gb->screen.scanline_clock = 0;
 
         if (gb->screen.ly < 144) {
-            // Draw the scanline
-            ppu_draw_scanline(gb->screen.ly, gb);
+            if (!gb->screen.pixel_fifo) {
+                // Draw the scanline
+                ppu_draw_scanline(gb->screen.ly, gb);
+            } else if (gb->screen.fifo.window) {
+                // The scanline was already drawn during mode 3
+                gb->screen.window_scanline += 1;
+            }
         }
 
         if ((gb->screen.ly += 1) >= LCD_LINES) {
@@ -310,7 +596,6 @@ int ppu_cycle(gb_system_t *gb)
                 lcd_stat_int = true;
 
             gb->screen.oam_buffer_size = 0;
-            gb->screen.oam_search_index = 0;
         } else if (gb->screen.lcd_stat.mode == LCDC_MODE_0) {
             if (gb->screen.lcd_stat.hblank_int)
                 lcd_stat_int = true;
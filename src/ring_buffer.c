@@ -0,0 +1,97 @@
+/*
+ring_buffer.c
+Lock-free single-producer/single-consumer ring buffer
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "xalloc.h"
+#include "ring_buffer.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initialize *rb to hold at least capacity elements of elem_size bytes
+void ring_buffer_init(ring_buffer_t *rb, const size_t elem_size, size_t capacity)
+{
+    size_t size = 1;
+
+    while (size < capacity)
+        size <<= 1;
+
+    rb->data = xalloc(size * elem_size);
+    rb->elem_size = elem_size;
+    rb->capacity = size;
+    rb->mask = size - 1;
+    atomic_init(&rb->head, 0);
+    atomic_init(&rb->tail, 0);
+}
+
+// Free the elements of *rb
+void ring_buffer_free(ring_buffer_t *rb)
+{
+    free(rb->data);
+    rb->data = NULL;
+}
+
+// Copy count elements between the ring at index and *buf, in at most two
+// parts when the range wraps around
+static void ring_buffer_copy(ring_buffer_t *rb, size_t index, void *buf, size_t count, const bool to_ring)
+{
+    size_t start = index & rb->mask;
+    size_t first = rb->capacity - start;
+    unsigned char *ptr = buf;
+
+    if (first > count)
+        first = count;
+
+    if (to_ring) {
+        memcpy(rb->data + start * rb->elem_size, ptr, first * rb->elem_size);
+        memcpy(rb->data, ptr + first * rb->elem_size, (count - first) * rb->elem_size);
+    } else {
+        memcpy(ptr, rb->data + start * rb->elem_size, first * rb->elem_size);
+        memcpy(ptr + first * rb->elem_size, rb->data, (count - first) * rb->elem_size);
+    }
+}
+
+// Push up to count elements from *src (producer only)
+// Returns the number of elements pushed, elements that do not fit are dropped
+size_t ring_buffer_push(ring_buffer_t *rb, const void *src, size_t count)
+{
+    size_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    size_t space = rb->capacity - (head - tail);
+
+    if (count > space)
+        count = space;
+    ring_buffer_copy(rb, head, (void *) src, count, true);
+    atomic_store_explicit(&rb->head, head + count, memory_order_release);
+    return count;
+}
+
+// Pop up to count elements to *dest (consumer only)
+// Returns the number of elements popped
+size_t ring_buffer_pop(ring_buffer_t *rb, void *dest, size_t count)
+{
+    size_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+    size_t available = head - tail;
+
+    if (count > available)
+        count = available;
+    ring_buffer_copy(rb, tail, dest, count, false);
+    atomic_store_explicit(&rb->tail, tail + count, memory_order_release);
+    return count;
+}
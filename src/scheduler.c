@@ -0,0 +1,74 @@
+/*
+scheduler.c
+Events scheduled at a given cycle
+Components that only need to act at a known point in the future schedule an
+event instead of being clocked on every cycle
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "gameboy.h"
+#include "scheduler.h"
+#include "ppu/ppu.h"
+#include "timer.h"
+
+static const event_handler_t event_handlers[EVENT_COUNT] = {
+    [EVENT_DMA_END]     = &ppu_dma_end,
+    [EVENT_TIMA_RELOAD] = &timer_tima_reload
+};
+
+// Update the cycle # of the next event
+static void scheduler_update_next(gb_system_t *gb)
+{
+    gb->scheduler.next = SCHEDULER_NEVER;
+    for (int i = 0; i < EVENT_COUNT; ++i) {
+        if (gb->scheduler.at[i] < gb->scheduler.next)
+            gb->scheduler.next = gb->scheduler.at[i];
+    }
+}
+
+// Remove all scheduled events
+void scheduler_reset(gb_system_t *gb)
+{
+    for (int i = 0; i < EVENT_COUNT; ++i)
+        gb->scheduler.at[i] = SCHEDULER_NEVER;
+    gb->scheduler.next = SCHEDULER_NEVER;
+}
+
+// Schedule event at cycle # (replaces the event if it was already scheduled)
+void scheduler_add(enum gb_event event, size_t cycle, gb_system_t *gb)
+{
+    gb->scheduler.at[event] = cycle;
+    scheduler_update_next(gb);
+}
+
+// Unschedule event
+void scheduler_remove(enum gb_event event, gb_system_t *gb)
+{
+    gb->scheduler.at[event] = SCHEDULER_NEVER;
+    scheduler_update_next(gb);
+}
+
+// Run all the events that are due
+void scheduler_run(gb_system_t *gb)
+{
+    for (int i = 0; i < EVENT_COUNT; ++i) {
+        if (gb->scheduler.at[i] <= gb->cycle_nb) {
+            gb->scheduler.at[i] = SCHEDULER_NEVER;
+            (*event_handlers[i])(gb);
+        }
+    }
+    scheduler_update_next(gb);
+}
@@ -21,6 +21,8 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "logger.h"
 #include "gameboy.h"
 #include "cpu/interrupts.h"
+#include "link.h"
+#include "serial_sink.h"
 
 #define SERIAL_CLOCKS(freq) (CPU_CLOCK_SPEED / (freq))
 
@@ -51,13 +53,9 @@ bool serial_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
             }
             if (gb->serial.sc.internal_clock) {
                 gb->serial.clock_speed = SERIAL_CLOCKS(SERIAL_FREQ);
-            } else if (gb->serial.plugged) {
-                // A link cable is plugged
-                // TODO: Retrieve the actual external clock speed from the
-                //       other emulator
-                gb->serial.clock_speed = SERIAL_CLOCKS(SERIAL_FREQ);
             } else {
-                // No link cable, there is no external clock
+                // The external clock is driven by the other side of the
+                // link cable, which ends the transfer (if any)
                 gb->serial.clock_speed = 0;
             }
             return true;
@@ -68,14 +66,29 @@ bool serial_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
     }
 }
 
-// TODO: Emulate link cable between two emulators
-// TODO: Add an option to dump the serial transfers
+// End the current transfer, in is the byte shifted in
+void serial_transfer_end(byte_t in, gb_system_t *gb)
+{
+    // The byte sent is still in SB when the other side drives the clock
+    if (gb->serial.sink)
+        serial_sink_write(gb->serial.sink,
+                          gb->serial.sc.internal_clock ? gb->serial.sb_out : gb->serial.sb);
+
+    gb->serial.sb = in;
+    gb->serial.shifts = 0;
+    gb->serial.shift_clock = 0;
+    gb->serial.sc.transfer_start = 0;
+    logger(LOG_DEBUG, "Serial IN: %02X", in);
+    cpu_int_flag_set(INT_SERIAL_BIT, gb);
+}
+
 // Equivalent of cpu_cycle() for the Serial Port
 void serial_cycle(gb_system_t *gb)
 {
+    byte_t in;
+
     // Clock only when the transfer start flag is set to 1 and we have a
-    // clock speed (internal or external)
-    // If the clock speed is 0, the link cable is not plugged
+    // clock speed (internal clock)
     if (     gb->serial.sc.transfer_start
         &&   gb->serial.clock_speed > 0
         &&  (gb->serial.shift_clock += 1) >= gb->serial.clock_speed)
@@ -83,24 +96,34 @@ void serial_cycle(gb_system_t *gb)
         gb->serial.shift_clock = 0;
         if (gb->serial.shifts == 0) {
             // First shift initializes the in/out bytes
-            if (gb->serial.plugged) {
-                logger(LOG_CRIT, "Link emulation is not implemented yet");
-                gb->serial.sb_in = 0xFF;
-            } else {
-                // When the serial port is not plugged, received bits are 1
-                gb->serial.sb_in = 0xFF;
-            }
+            // The remote byte is only known at the end of the transfer,
+            // when the link cable is not plugged received bits are 1
+            gb->serial.sb_out = gb->serial.sb;
+            gb->serial.sb_in = 0xFF;
+            if (gb->serial.link)
+                link_transfer_start(gb->serial.sb_out, gb);
         }
 
-        gb->serial.sb <<= 1; // Local bit out
-        gb->serial.sb |= (gb->serial.sb_in >> 7); // Remote bit in
-        gb->serial.sb_in <<= 1; // Remote bit out
+        if (gb->serial.shifts < 8) {
+            gb->serial.sb <<= 1; // Local bit out
+            gb->serial.sb |= (gb->serial.sb_in >> 7); // Remote bit in
+            gb->serial.sb_in <<= 1; // Remote bit out
+            gb->serial.shifts += 1;
+        }
 
-        if ((gb->serial.shifts += 1) >= 8) {
-            gb->serial.shifts = 0;
-            gb->serial.sc.transfer_start = 0;
-            logger(LOG_DEBUG, "Serial IN: %02X", gb->serial.sb);
-            cpu_int_flag_set(INT_SERIAL_BIT, gb);
+        // The other process may not have answered yet, the transfer ends
+        // at a later shift clock once it did
+        if (gb->serial.shifts >= 8) {
+            if (!gb->serial.link) {
+                serial_transfer_end(gb->serial.sb, gb);
+            } else if (link_transfer_end(gb->serial.sb_out, &in, gb)) {
+                serial_transfer_end(in, gb);
+            }
         }
+    } else if (   gb->serial.sc.transfer_start
+               && gb->serial.link
+               && !gb->serial.sc.internal_clock)
+    {
+        link_poll(gb);
     }
 }
\ No newline at end of file
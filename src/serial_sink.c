@@ -0,0 +1,118 @@
+/*
+serial_sink.c
+Capture of the bytes sent over the serial port
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include "xalloc.h"
+#include "serial_sink.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Create a sink, bytes are appended to buffer if it is not NULL
+serial_sink_t *serial_sink_create(byte_t *buffer, size_t capacity)
+{
+    serial_sink_t *sink = xzalloc(sizeof(serial_sink_t));
+
+    sink->buffer = buffer;
+    sink->capacity = buffer ? capacity : 0;
+    sink->matched = -1;
+    return sink;
+}
+
+// Also write the bytes to filename ("-" for the standard output)
+// Returns false on error
+bool serial_sink_open(serial_sink_t *sink, const char *filename)
+{
+    FILE *file;
+
+    if (!strcmp(filename, "-")) {
+        file = stdout;
+    } else if (!(file = fopen(filename, "wb"))) {
+        logger(LOG_ERROR, "serial_sink: %s: %s", filename, strerror(errno));
+        return false;
+    } else {
+        setvbuf(file, NULL, _IOFBF, SERIAL_SINK_FILE_BUFFER);
+    }
+
+    if (sink->close_file)
+        fclose(sink->file);
+    sink->file = file;
+    sink->close_file = (file != stdout);
+    return true;
+}
+
+// Stop when the output ends with pattern
+// Returns false if there are too many patterns or if it is too long
+bool serial_sink_stop_on(serial_sink_t *sink, const char *pattern)
+{
+    const size_t len = strlen(pattern);
+
+    if (len == 0 || len > SERIAL_SINK_WINDOW) {
+        logger(LOG_ERROR, "serial_sink: Stop patterns must be 1 to %i bytes long", SERIAL_SINK_WINDOW);
+        return false;
+    }
+    if (sink->patterns_nb >= SERIAL_SINK_PATTERNS) {
+        logger(LOG_ERROR, "serial_sink: Too many stop patterns (max %i)", SERIAL_SINK_PATTERNS);
+        return false;
+    }
+
+    sink->patterns[sink->patterns_nb] = pattern;
+    sink->patterns_len[sink->patterns_nb] = len;
+    sink->patterns_nb += 1;
+    return true;
+}
+
+// Append a byte sent over the serial port
+void serial_sink_write(serial_sink_t *sink, byte_t value)
+{
+    if (sink->size < sink->capacity)
+        sink->buffer[sink->size++] = value;
+    sink->total += 1;
+    if (sink->file)
+        fputc(value, sink->file);
+
+    if (sink->patterns_nb == 0 || sink->matched >= 0)
+        return;
+
+    memmove(sink->window, sink->window + 1, SERIAL_SINK_WINDOW - 1);
+    sink->window[SERIAL_SINK_WINDOW - 1] = value;
+    for (int i = 0; i < sink->patterns_nb; ++i) {
+        if (   sink->total >= sink->patterns_len[i]
+            && !memcmp(sink->window + SERIAL_SINK_WINDOW - sink->patterns_len[i],
+                       sink->patterns[i], sink->patterns_len[i]))
+        {
+            logger(LOG_DEBUG, "serial_sink: Matched '%s'", sink->patterns[i]);
+            sink->matched = i;
+            break;
+        }
+    }
+}
+
+// Flush and close the output file, then free the sink
+// The caller buffer is not freed
+void serial_sink_destroy(serial_sink_t *sink)
+{
+    if (sink->file) {
+        if (sink->close_file)
+            fclose(sink->file);
+        else
+            fflush(sink->file);
+    }
+    free(sink);
+}
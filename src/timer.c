@@ -19,6 +19,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 #include "logger.h"
 #include "gameboy.h"
+#include "scheduler.h"
 #include "cpu/interrupts.h"
 
 static const uint16_t clock_divider[4] = {TIM_CLOCK_0, TIM_CLOCK_1, TIM_CLOCK_2, TIM_CLOCK_3};
@@ -26,18 +27,117 @@ static const uint16_t clock_divider[4] = {TIM_CLOCK_0, TIM_CLOCK_1, TIM_CLOCK_2,
 #define high_to_low(initial, new, mask) (((initial) & (mask)) && !((new) & (mask)))
 #define log_obscure(msg) logger(LOG_INFO, msg)
 
+// Delay between a TIMA overflow and its reload with TMA
+#define TIMA_RELOAD_DELAY (4)
+
 // Increment TIMA
 // If TIMA overflows set tima_overflow to delay the overflow behavior
 // by 4 clocks
 static inline void timer_tima_inc(gb_system_t *gb)
 {
     if ((gb->timer.tima += 1) == 0) {
-        gb->timer.tima_overflow = 4;
+        gb->timer.tima_overflow = TIMA_RELOAD_DELAY;
+    }
+}
+
+// Emulate a single timer cycle
+static void timer_cycle(gb_system_t *gb)
+{
+    uint16_t old_counter = gb->timer.counter;
+
+    gb->timer.counter += 1;
+    if (high_to_low(old_counter, gb->timer.counter, divider_mask(TIM_CLOCK_DIV)))
+        gb->timer.div += 1;
+
+    if (gb->timer.tima_overflow > 0) {
+        if ((gb->timer.tima_overflow -= 1) == 0) {
+            gb->timer.tima = gb->timer.tma;
+            cpu_int_flag_set(INT_TIMER_BIT, gb);
+        }
     }
+
+    if (gb->timer.tac.enable && high_to_low(old_counter, gb->timer.counter, divider_mask(gb->timer.tima_clock)))
+        timer_tima_inc(gb);
+}
+
+// Advance the counter by clocks and DIV with it
+// A falling edge of a counter bit happens every time the counter crosses a
+// multiple of twice that bit
+static inline void timer_counter_add(const size_t clocks, gb_system_t *gb)
+{
+    const size_t counter = gb->timer.counter + clocks;
+
+    gb->timer.div += (counter / TIM_CLOCK_DIV) - (gb->timer.counter / TIM_CLOCK_DIV);
+    gb->timer.counter = counter;
+}
+
+// Returns the number of clocks before TIMA overflows
+static inline size_t timer_clocks_to_overflow(gb_system_t *gb)
+{
+    const size_t clock = gb->timer.tima_clock;
+
+    return (clock - (gb->timer.counter % clock)) + ((size_t) (0xFF - gb->timer.tima) * clock);
+}
+
+// Emulate the timer up to the current cycle
+// The counter and TIMA are advanced at once, only the few cycles between an
+// overflow and the reload are emulated one by one
+void timer_sync(gb_system_t *gb)
+{
+    size_t clocks = gb->cycle_nb + 1 - gb->timer.cycle;
+    size_t to_overflow;
+
+    gb->timer.cycle = gb->cycle_nb + 1;
+    while (clocks > 0) {
+        if (gb->timer.tima_overflow > 0) {
+            timer_cycle(gb);
+            clocks -= 1;
+            continue;
+        }
+
+        if (!gb->timer.tac.enable) {
+            timer_counter_add(clocks, gb);
+            return;
+        }
+
+        to_overflow = timer_clocks_to_overflow(gb);
+        if (clocks < to_overflow) {
+            gb->timer.tima += ((gb->timer.counter % gb->timer.tima_clock) + clocks) / gb->timer.tima_clock;
+            timer_counter_add(clocks, gb);
+            return;
+        }
+
+        timer_counter_add(to_overflow, gb);
+        gb->timer.tima = 0;
+        gb->timer.tima_overflow = TIMA_RELOAD_DELAY;
+        clocks -= to_overflow;
+    }
+}
+
+// Schedule the next TIMA reload (the timer must be synchronized)
+static void timer_schedule(gb_system_t *gb)
+{
+    if (gb->timer.tima_overflow > 0) {
+        scheduler_add(EVENT_TIMA_RELOAD, gb->timer.cycle + gb->timer.tima_overflow - 1, gb);
+    } else if (gb->timer.tac.enable) {
+        scheduler_add(EVENT_TIMA_RELOAD,
+            gb->timer.cycle + timer_clocks_to_overflow(gb) + TIMA_RELOAD_DELAY - 1, gb);
+    } else {
+        scheduler_remove(EVENT_TIMA_RELOAD, gb);
+    }
+}
+
+// TIMA reload event, requests the timer interrupt
+void timer_tima_reload(gb_system_t *gb)
+{
+    timer_sync(gb);
+    timer_schedule(gb);
 }
 
 byte_t timer_reg_readb(uint16_t addr, gb_system_t *gb)
 {
+    timer_sync(gb);
+
     switch (addr) {
         case TIM_DIV : return gb->timer.div;
         case TIM_TIMA: return gb->timer.tima;
@@ -54,6 +154,7 @@ bool timer_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
     uint16_t old_clock;
     byte_t old_enable;
 
+    timer_sync(gb);
     switch (addr) {
         case TIM_DIV:
             gb->timer.div = 0;
@@ -93,25 +194,6 @@ bool timer_reg_writeb(uint16_t addr, byte_t value, gb_system_t *gb)
             logger(LOG_ERROR, "timer_reg_writeb failed: unhandled address $%04X", addr);
             return false;
     }
+    timer_schedule(gb);
     return true;
 }
-
-// Emulate a timer cycle
-void timer_cycle(gb_system_t *gb)
-{
-    uint16_t old_counter = gb->timer.counter;
-
-    gb->timer.counter += 1;
-    if (high_to_low(old_counter, gb->timer.counter, divider_mask(TIM_CLOCK_DIV)))
-        gb->timer.div += 1;
-
-    if (gb->timer.tima_overflow > 0) {
-        if ((gb->timer.tima_overflow -= 1) == 0) {
-            gb->timer.tima = gb->timer.tma;
-            cpu_int_flag_set(INT_TIMER_BIT, gb);
-        }
-    }
-
-    if (gb->timer.tac.enable && high_to_low(old_counter, gb->timer.counter, divider_mask(gb->timer.tima_clock)))
-        timer_tima_inc(gb);
-}
\ No newline at end of file
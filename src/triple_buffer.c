@@ -0,0 +1,42 @@
+/*
+triple_buffer.c
+Lock-free triple buffer to pass frames between two threads
+
+Copyright (C) 2020 akrocynova
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "triple_buffer.h"
+#include <string.h>
+
+// Initialize *tb with blank frames
+void triple_buffer_init(triple_buffer_t *tb)
+{
+    memset(tb->frames, 0xFF, sizeof(tb->frames));
+    tb->back = 0;
+    atomic_init(&tb->middle, 1);
+    tb->front = 2;
+}
+
+// Swap the front frame with the middle one if a new frame was published
+// Returns true if the front frame changed
+bool triple_buffer_acquire(triple_buffer_t *tb)
+{
+    if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH))
+        return false;
+
+    tb->front = atomic_exchange_explicit(&tb->middle, tb->front,
+        memory_order_acq_rel) & 0x3;
+    return true;
+}
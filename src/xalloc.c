@@ -48,6 +48,19 @@ void *xzalloc(size_t size)
     return ptr;
 }
 
+// Resize *ptr to SIZE bytes of memory
+void *xrealloc(void *ptr, size_t size)
+{
+    void *new_ptr;
+
+    if (!(new_ptr = realloc(ptr, size))) {
+        fprintf(stderr, "%zu bytes memory allocation failed\n", size);
+        abort();
+    }
+
+    return new_ptr;
+}
+
 // Duplicate *s
 char *xstrdup(const char *s)
 {